@@ -0,0 +1,124 @@
+/*
+	Measures the throughput of the built-in inflater over the compressed cels of real files.
+
+		cc -O2 -I../src inflate_bench.c -o inflate_bench -lpthread
+		./inflate_bench player.ase slime.ase
+
+	The implementation is compiled into this file, so the internal s_inflate() is called directly
+	and the numbers don't include parsing, allocation or compositing.
+*/
+
+#define CUTE_ASEPRITE_IMPLEMENTATION
+#include "cute_aseprite.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct cel_stream_t
+{
+	const uint8_t* zlib;
+	int zlib_bytes;
+	int pixels_bytes;
+} cel_stream_t;
+
+static cel_stream_t* streams;
+static int stream_count;
+static int stream_capacity;
+
+static uint16_t read_u16(const uint8_t* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t read_u32(const uint8_t* p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static double now_seconds(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// Walks the frame and chunk headers of a file and records every compressed image cel (type 2).
+static void collect_streams(const uint8_t* file, size_t size)
+{
+	if (size < 128 || read_u16(file + 4) != 0xA5E0) return;
+	int frame_count = read_u16(file + 6);
+	int bpp = read_u16(file + 12) / 8;
+	size_t frame_at = 128;
+	for (int i = 0; i < frame_count && frame_at + 16 <= size; ++i) {
+		uint32_t frame_size = read_u32(file + frame_at);
+		uint32_t chunk_count = read_u32(file + frame_at + 12);
+		if (!chunk_count) chunk_count = read_u16(file + frame_at + 6);
+		if (frame_size < 16 || frame_at + frame_size > size) return;
+		size_t chunk_at = frame_at + 16;
+		for (uint32_t j = 0; j < chunk_count && chunk_at + 6 <= frame_at + frame_size; ++j) {
+			uint32_t chunk_size = read_u32(file + chunk_at);
+			if (chunk_size < 6 || chunk_at + chunk_size > frame_at + frame_size) return;
+			const uint8_t* data = file + chunk_at + 6;
+			if (read_u16(file + chunk_at + 4) == 0x2005 && chunk_size >= 6 + 20 && read_u16(data + 7) == 2) {
+				if (stream_count == stream_capacity) {
+					stream_capacity = stream_capacity ? stream_capacity * 2 : 64;
+					streams = (cel_stream_t*)realloc(streams, sizeof(cel_stream_t) * stream_capacity);
+				}
+				cel_stream_t* stream = streams + stream_count++;
+				stream->zlib = data + 20;
+				stream->zlib_bytes = (int)chunk_size - 6 - 20;
+				stream->pixels_bytes = read_u16(data + 16) * read_u16(data + 18) * bpp;
+			}
+			chunk_at += chunk_size;
+		}
+		frame_at += frame_size;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		printf("usage: %s file.ase...\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		FILE* fp = fopen(argv[i], "rb");
+		if (!fp) continue;
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		uint8_t* file = (uint8_t*)malloc((size_t)size);
+		if (fread(file, 1, (size_t)size, fp) == (size_t)size) collect_streams(file, (size_t)size);
+		fclose(fp);
+		// The file stays allocated, the recorded streams point into it.
+	}
+
+	int largest = 0;
+	double in_total = 0, out_total = 0;
+	for (int i = 0; i < stream_count; ++i) {
+		if (streams[i].pixels_bytes > largest) largest = streams[i].pixels_bytes;
+		in_total += streams[i].zlib_bytes;
+		out_total += streams[i].pixels_bytes;
+	}
+	if (!stream_count || !out_total) {
+		printf("No compressed cels found.\n");
+		return 1;
+	}
+	void* pixels = malloc((size_t)largest);
+
+	// Repeat the whole set until at least a second has passed, so small files still time reliably.
+	int rounds = 0, failures = 0;
+	double start = now_seconds(), elapsed = 0;
+	do {
+		for (int i = 0; i < stream_count; ++i) {
+			const char* error_reason = NULL;
+			if (streams[i].zlib_bytes < 2 || !s_inflate(streams[i].zlib + 2, streams[i].zlib_bytes - 2, pixels, streams[i].pixels_bytes, &error_reason)) {
+				failures++;
+			}
+		}
+		rounds++;
+		elapsed = now_seconds() - start;
+	} while (elapsed < 1.0);
+
+	printf("%d cels, %.1f KB in, %.1f KB out, %d rounds in %.3f s\n", stream_count, in_total / 1024, out_total / 1024, rounds, elapsed);
+	printf("inflate: %.1f MB/s out, %.1f MB/s in\n", out_total * rounds / elapsed / (1024 * 1024), in_total * rounds / elapsed / (1024 * 1024));
+	if (failures) printf("%d cels failed to inflate\n", failures / rounds);
+
+	free(pixels);
+	return failures ? 1 : 0;
+}
@@ -1,323 +1,2777 @@
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
 #include <raylib.h>
+#include <rlgl.h>
+
+#if defined(_WIN32)
+	#include <process.h>	// _getpid
+	#define getpid _getpid
+	// Declared by hand like in cute_aseprite.h, windows.h clashes with raylib.h. SRWLOCK and
+	// CONDITION_VARIABLE are a single pointer each, zero initialized.
+	__declspec(dllimport) void __stdcall AcquireSRWLockExclusive(void **lock);
+	__declspec(dllimport) void __stdcall ReleaseSRWLockExclusive(void **lock);
+	__declspec(dllimport) int __stdcall SleepConditionVariableSRW(void **condition, void **lock, unsigned long milliseconds, unsigned long flags);
+	__declspec(dllimport) void __stdcall WakeAllConditionVariable(void **condition);
+#else
+	#include <unistd.h>	// getpid, read, close
+	#include <pthread.h>	// pthread_mutex_t, pthread_cond_t
+#endif
+
+#if defined(__linux__)
+	#include <sys/inotify.h>
+#endif
 
 #define CUTE_ASEPRITE_IMPLEMENTATION
 #include <cute_aseprite.h>
 
 #include <aseprite.h>
 
-static Aseprite _load_aseprite(ase_t *cute_ase, AseLoadFlags flags);
+static AseDecoded _decode_aseprite(ase_t *cute_ase, AseLoadFlags flags, ase_error_t error);
 
-static void _load_aseprite_frames(ase_t *cute_ase, Aseprite *ase);
-static void _load_aseprite_layers(ase_t *cute_ase, Aseprite *ase);
-static void _load_aseprite_tags(ase_t *cute_ase, Aseprite *ase);
-static void _load_aseprite_palette(ase_t *cute_ase, Aseprite *ase);
+static Aseprite _load_aseprite_cached(const char *filename, AseLoadFlags flags);
+static char *_cache_path(unsigned long long hash, int size, AseLoadFlags flags, const char *suffix);
+
+// The files of a LoadAsepriteBatch, each decoded by whichever worker thread picks its index.
+typedef struct _AseBatch
+{
+	const char **filenames;
+	AseLoadFlags flags;
+	AseDecoded *decoded;
+} _AseBatch;
+
+static void _decode_batch_job(int index, void *udata);
+
+static void _decode_aseprite_frames(ase_t *cute_ase, AseDecoded *decoded);
+static void _decode_aseprite_layers(ase_t *cute_ase, AseDecoded *decoded);
+static void _decode_aseprite_tags(ase_t *cute_ase, AseDecoded *decoded);
+static void _decode_aseprite_palette(ase_t *cute_ase, AseDecoded *decoded);
+
+static Aseprite _upload_aseprite(AseDecoded decoded, int owns_pixels);
+static void _upload_aseprite_layers(AseDecoded *decoded, Aseprite *ase);
+
+static Image _decode_cel_image(ase_t *cute_ase, ase_cel_t *cute_cel);
+static void _copy_cel_area(ase_t *cute_ase, ase_cel_t *cute_cel, Rectangle area, Color *pixels, int stride);
+static void _copy_cel_indices(ase_cel_t *cute_cel, Rectangle area, unsigned char *indices, int stride);
+static ase_cel_t *_find_cute_cel(ase_t *cute_ase, int layer, int frame);
+static int _find_linked_cel(ase_t *cute_ase, ase_cel_t **cute_cel);
+static int _blends_palette_colors(ase_t *cute_ase);
+static void _load_lazy_cel(Aseprite ase, int layer, int frame);
+
+// One of the atlases of an Aseprite kept under the texture budget, texture.id is 0 while evicted.
+typedef struct _AseResidentTexture
+{
+	Texture2D texture;
+	Image image;	// Kept to upload the texture again, or the Aseprite's indices of it when lut is set
+	Color *lut;	// Color of each of the 256 indices of an indexed atlas, NULL when image holds the colors
+
+	struct _AseResidentTexture *newer;
+	struct _AseResidentTexture *older;
+} _AseResidentTexture;
+
+// Which atlas of an Aseprite, also the index of its _AseResidentTexture.
+typedef enum _AseAtlas
+{
+	_ASE_FRAMES_ATLAS,
+	_ASE_CELS_ATLAS
+} _AseAtlas;
+
+static void _manage_textures(Aseprite *ase, Image frames_image, Image cels_image, int owns_pixels);
+static void _unmanage_textures(Aseprite ase);
+static Texture2D _use_texture(Aseprite ase, _AseAtlas atlas);
+static void _update_texture_area(Aseprite ase, _AseAtlas atlas, Rectangle area, const Color *pixels);
+static int _index_texture(_AseResidentTexture *resident, Image image, Image indices);
+static void _unindex_texture(_AseResidentTexture *resident);
+static void _make_room(long long size);
+static void _evict_texture(_AseResidentTexture *resident);
+static void _link_newest(_AseResidentTexture *resident);
+static void _unlink_texture(_AseResidentTexture *resident);
+static long long _resident_size(_AseResidentTexture *resident);
+
+// What WatchAseprite() keeps between reloads.
+struct AseWatch
+{
+	Aseprite *ase;
+	char *filename;
+
+	int inotify;	// -1 when the modification time is polled instead
+	long mod_time;
+
+	unsigned long long *frame_hashes;	// NULL until the first reload, which then uploads everything
+	unsigned long long *cel_hashes;
+
+	char **old_tag_names;	// Names of tags replaced by a new layout, animations may still hold them
+	int old_tag_name_count;
+};
+
+static int _watched_file_changed(AseWatch *watch);
+static AseDecoded _decode_watched_file(AseWatch *watch);
+static int _reload_in_place(AseWatch *watch, AseDecoded *decoded, unsigned long long *frame_hashes, unsigned long long *cel_hashes);
+static void _keep_old_tag_names(AseWatch *watch);
+static void _hash_decoded(AseDecoded *decoded, unsigned long long **frame_hashes, unsigned long long **cel_hashes);
+static unsigned long long _hash_image_area(Image image, Rectangle area);
+static void _reload_area(Aseprite *ase, _AseAtlas atlas, Image image, Rectangle area);
+static void _copy_image_area(Image image, Rectangle area, Color *pixels);
+
+// An Aseprite shared through AcquireAseprite(), entries never move so their ase can be handed out.
+typedef struct _AseRegistryEntry
+{
+	char *filename;
+	AseLoadFlags flags;
+
+	int references;
+	int loaded;	// Cleared while the first acquirer is still loading it
+
+	Aseprite ase;
+
+	struct _AseRegistryEntry *next;
+} _AseRegistryEntry;
+
+static void _lock_registry(void);
+static void _unlock_registry(void);
+static void _wait_registry(void);
+static void _wake_registry(void);
+static void _drop_registry_entry(_AseRegistryEntry *entry);
+
+static void _load_lazy_cels(Aseprite ase);
+static void _recolor_atlas(Aseprite ase, _AseAtlas atlas, Image indices, const Color *lut);
+static void _build_palette_lut(Color *lut, const Color *palette, int color_count, int transparent_index);
+static Image _expand_indices(Image indices, const Color *lut);
+static Image _gen_index_image(int width, int height, int transparent_index);
+
+// A rectangle to place in an atlas, id says what it belongs to.
+typedef struct _AsePackRect
+{
+	int id;
+
+	int x;
+	int y;
+	int width;
+	int height;
+} _AsePackRect;
+
+static void _pack_rects(_AsePackRect *rects, int count, int *width, int *height);
+static int _compare_pack_rects(const void *a, const void *b);
+static Rectangle _alpha_bounds(const Color *pixels, int width, int height);
+static Rectangle _index_bounds(const unsigned char *indices, int width, int height, int transparent_index);
+
+static unsigned long long _hash_bytes(const void *data, size_t size);
+
+static unsigned long long _binary_metadata_size(int frame_count, int layer_count, int layer_cel_count, int tag_count, int color_count);
+static AseDecoded _read_aseprite_binary(const unsigned char *data, int size, int copy_pixels);
+static int _rect_in_image(Rectangle rect, unsigned int width, unsigned int height);
+static void _write_u32(unsigned char **cursor, unsigned int value);
+static void _write_f32(unsigned char **cursor, float value);
+static unsigned int _read_u32(const unsigned char **cursor);
+static float _read_f32(const unsigned char **cursor);
 
 static int _aseprite_flags_check(AseLoadFlags flags, AseLoadFlags check);
+static ase_load_flags_t _cute_load_flags(AseLoadFlags flags);
+
+static int _aseprite_inflate(const void *data, int data_size, void *pixels, int pixels_size, void *udata);
 
 static AseAnimation _create_animation_from_tag(Aseprite *ase, AseTag tag);
 static void _advance_animation_tag_mode(AseAnimation *anim);
+static void _clamp_animation(AseAnimation *anim);
+
+static AseInflateCallback _inflate_callback = NULL;
+static char *_cache_directory = NULL;
+static _AseRegistryEntry *_registry = NULL;
+#if defined(_WIN32)
+static void *_registry_lock = NULL;
+static void *_registry_loaded = NULL;
+#else
+static pthread_mutex_t _registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _registry_loaded = PTHREAD_COND_INITIALIZER;
+#endif
+
+static long long _texture_budget = 0;
+static long long _texture_memory = 0;
+static _AseResidentTexture *_newest_texture = NULL;
+static _AseResidentTexture *_oldest_texture = NULL;
+
+#define P_ANIMATION_CHECK(anim) if (anim == NULL) return; \
+								if (!anim->ready || anim->ase == NULL) return; \
+								if (!_aseprite_flags_check(anim->ase->flags, ASEPRITE_LOAD_TAGS)) return;
+
+#define ANIMATION_CHECK(anim) 	if (!anim.ready || anim.ase == NULL) return; \
+								if (!_aseprite_flags_check(anim.ase->flags, ASEPRITE_LOAD_TAGS)) return;
+
+// Memory management functions
+
+AseDecoded _decode_aseprite(ase_t *cute_ase, AseLoadFlags flags, ase_error_t error)
+{
+	if (cute_ase == NULL || flags == 0)
+		return (AseDecoded){ .error = (AseError)error };
+	
+	AseDecoded decoded = {0};
+
+	// Only indexed files have indices to keep. Translucent cels or colors blend into colors that are
+	// not in the palette, recoloring their frames from indices would draw them opaque, so those files
+	// keep none either.
+
+	if (cute_ase->mode != ASE_MODE_INDEXED || _blends_palette_colors(cute_ase))
+		flags &= ~ASEPRITE_LOAD_INDEXED;
+
+	decoded.flags = flags;
+	decoded.error = (AseError)error;
+
+	decoded.width = cute_ase->w;
+	decoded.height = cute_ase->h;
+
+	if (flags & ASEPRITE_LOAD_INDEXED)
+		decoded.transparent_index = cute_ase->transparent_palette_entry_index;
+
+	if (flags & ASEPRITE_LOAD_FRAMES)
+		_decode_aseprite_frames(cute_ase, &decoded);
+
+	if (flags & ASEPRITE_LOAD_LAYERS)
+		_decode_aseprite_layers(cute_ase, &decoded);
+
+	if (flags & ASEPRITE_LOAD_TAGS)
+		_decode_aseprite_tags(cute_ase, &decoded);
+
+	if (flags & ASEPRITE_LOAD_PALETTE)
+		_decode_aseprite_palette(cute_ase, &decoded);
+
+	if ((flags & ASEPRITE_LOAD_LAZY_CELS) && (flags & ASEPRITE_LOAD_LAYERS))
+	{
+		// Keep the parsed file for the cels, the composited frames are already copied out.
+
+		decoded.source = cute_ase;
+
+		for (int i = 0; i < cute_ase->frame_count; i++)
+		{
+			free(cute_ase->frames[i].pixels);
+			cute_ase->frames[i].pixels = NULL;
+
+			free(cute_ase->frames[i].indices);
+			cute_ase->frames[i].indices = NULL;
+		}
+	}
+	else
+		cute_aseprite_free(cute_ase);
+
+	return decoded;
+}
+
+void _decode_aseprite_frames(ase_t *cute_ase, AseDecoded *decoded)
+{
+	decoded->frame_count = cute_ase->frame_count;
+	decoded->frames = (AseFrame *)calloc(cute_ase->frame_count, sizeof(AseFrame));
+
+	// Frames with identical pixels, like held frames, share one area of the image.
+
+	size_t frame_size = (size_t)cute_ase->w * cute_ase->h * sizeof(Color);
+
+	// Indexed frames keep their indices in a second image laid out like the first.
+
+	int indexed = decoded->flags & ASEPRITE_LOAD_INDEXED;
+
+	unsigned long long *hashes = (unsigned long long *)malloc(sizeof(unsigned long long) * cute_ase->frame_count);
+	int *owners = (int *)malloc(sizeof(int) * cute_ase->frame_count);
+
+	_AsePackRect *rects = (_AsePackRect *)malloc(sizeof(_AsePackRect) * cute_ase->frame_count);
+	int rect_count = 0;
+
+	for (int i = 0; i < cute_ase->frame_count; i++)
+	{
+		AseFrame *frame = &decoded->frames[i];
+
+		frame->id = i;
+		frame->duration_milliseconds = (cute_ase->frames)[i].duration_milliseconds;
+
+		hashes[i] = _hash_bytes((cute_ase->frames)[i].pixels, frame_size);
+		owners[i] = i;
+
+		for (int k = 0; k < i; k++)
+		{
+			if (owners[k] != k || hashes[k] != hashes[i])
+				continue;
+
+			if (indexed && memcmp((cute_ase->frames)[k].indices, (cute_ase->frames)[i].indices, frame_size / sizeof(Color)) != 0)
+				continue;
+
+			if (memcmp((cute_ase->frames)[k].pixels, (cute_ase->frames)[i].pixels, frame_size) == 0)
+			{
+				owners[i] = k;
+				break;
+			}
+		}
+
+		if (owners[i] != i)
+			continue;
+
+		// Only the visible part of a frame is kept, fully transparent frames take no room at all. Every
+		// visible pixel of an indexed frame has an index, so the index bounds also hold any other palette.
+
+		Rectangle bounds;
+
+		if (indexed)
+			bounds = _index_bounds((cute_ase->frames)[i].indices, cute_ase->w, cute_ase->h, decoded->transparent_index);
+		else
+			bounds = _alpha_bounds((const Color *)(cute_ase->frames)[i].pixels, cute_ase->w, cute_ase->h);
+
+		frame->x_offset = bounds.x;
+		frame->y_offset = bounds.y;
+
+		frame->source.width = bounds.width;
+		frame->source.height = bounds.height;
+
+		if (bounds.width > 0)
+			rects[rect_count++] = (_AsePackRect){ .id = i, .width = bounds.width, .height = bounds.height };
+	}
+
+	int width = 0;
+	int height = 0;
+
+	_pack_rects(rects, rect_count, &width, &height);
+
+	Image image = GenImageColor(width, height, BLANK);
+
+	if (indexed)
+		decoded->frames_indices = _gen_index_image(width, height, decoded->transparent_index);
+
+	for (int r = 0; r < rect_count; r++)
+	{
+		AseFrame *frame = &decoded->frames[rects[r].id];
+		const Color *pixels = (const Color *)(cute_ase->frames)[rects[r].id].pixels;
+		const unsigned char *indices = (cute_ase->frames)[rects[r].id].indices;
+
+		frame->source.x = rects[r].x;
+		frame->source.y = rects[r].y;
+
+		for (int y = 0; y < rects[r].height; y++)
+		{
+			const Color *row = pixels + (size_t)(frame->y_offset + y) * cute_ase->w + (int)frame->x_offset;
+
+			memcpy((Color *)image.data + (size_t)(rects[r].y + y) * width + rects[r].x, row, rects[r].width * sizeof(Color));
+
+			if (indexed)
+			{
+				const unsigned char *index_row = indices + (size_t)(frame->y_offset + y) * cute_ase->w + (int)frame->x_offset;
+
+				memcpy((unsigned char *)decoded->frames_indices.data + (size_t)(rects[r].y + y) * width + rects[r].x, index_row, rects[r].width);
+			}
+		}
+	}
+
+	for (int i = 0; i < cute_ase->frame_count; i++)
+	{
+		AseFrame *frame = &decoded->frames[i];
+		AseFrame owner = decoded->frames[owners[i]];
+
+		frame->source = owner.source;
+
+		frame->x_offset = owner.x_offset;
+		frame->y_offset = owner.y_offset;
+	}
+
+	free(hashes);
+	free(owners);
+	free(rects);
+
+	decoded->frames_image = image;
+}
+void _decode_aseprite_layers(ase_t *cute_ase, AseDecoded *decoded)
+{
+	decoded->layer_count = cute_ase->layer_count;
+	decoded->layers = (AseDecodedLayer *)malloc(cute_ase->layer_count * sizeof(AseDecodedLayer));
+
+	decoded->layer_cel_count = cute_ase->frame_count;
+
+	for (int j = 0; j < cute_ase->layer_count; j++)
+	{
+		AseDecodedLayer *layer = &decoded->layers[j];
+		
+		*layer = (AseDecodedLayer){
+			.id = j,
+			.name = strdup(cute_ase->layers[j].name),
+
+			.opacity = cute_ase->layers[j].opacity,
+
+			.cels = calloc(cute_ase->frame_count, sizeof(AseDecodedCel))
+		};
+	}
+
+	for (int i = 0; i < cute_ase->frame_count; i++)
+	{
+		ase_frame_t *cute_frame = &cute_ase->frames[i];
+
+		for (int k = 0; k < cute_frame->cel_count; k++)
+		{
+			ase_cel_t *cute_cel = &cute_frame->cels[k];
+
+			int j = cute_cel->layer - cute_ase->layers;
+
+			AseDecodedCel cel = {0};
+
+			if (cute_cel->is_linked)
+			{
+				// Linked cels have no pixels of their own, they share the image and placement of their source.
+
+				cel.linked_frame = _find_linked_cel(cute_ase, &cute_cel);
+
+				if (cel.linked_frame < 0)
+					continue;
+
+				cel.is_linked = 1;
+			}
+
+			cel.active = 1;
+
+			cel.opacity = cute_cel->opacity;
+
+			float x_offset = cute_cel->x;
+			float y_offset = cute_cel->y;
+
+			Rectangle visible_area =
+			{
+				0, 0, cute_cel->w, cute_cel->h
+			};
+
+			if (x_offset < 0)
+			{
+				x_offset = 0;
+
+				visible_area.x = -cute_cel->x;
+				visible_area.width += cute_cel->x;
+			}
+
+			if (y_offset < 0)
+			{
+				y_offset = 0;
+
+				visible_area.y = -cute_cel->y;
+				visible_area.height += cute_cel->y;
+			}
+
+			if (x_offset + visible_area.width > cute_ase->w)
+			{
+				visible_area.width = cute_ase->w - x_offset;
+			}
+
+			if (y_offset + visible_area.height > cute_ase->h)
+			{
+				visible_area.height = cute_ase->h - y_offset;
+			}
+
+			cel.x_offset = x_offset;
+			cel.y_offset = y_offset;
+
+			cel.visible_area = visible_area;
+
+			decoded->layers[j].cels[i] = cel;
+		}
+	}
+
+	// The visible part of every cel goes into one atlas, so drawing any number of layers never switches
+	// textures. Linked cels share the area of their source, cels entirely off the canvas take no room.
+
+	int frame_count = cute_ase->frame_count;
+
+	_AsePackRect *rects = (_AsePackRect *)malloc(sizeof(_AsePackRect) * cute_ase->layer_count * frame_count);
+	int rect_count = 0;
+
+	for (int j = 0; j < cute_ase->layer_count; j++)
+	{
+		for (int i = 0; i < frame_count; i++)
+		{
+			AseDecodedCel *cel = &decoded->layers[j].cels[i];
+
+			if (!cel->active || cel->is_linked)
+				continue;
+
+			if (cel->visible_area.width <= 0 || cel->visible_area.height <= 0)
+			{
+				cel->visible_area = (Rectangle){0};
+				continue;
+			}
+
+			rects[rect_count++] = (_AsePackRect){ .id = j * frame_count + i, .width = cel->visible_area.width, .height = cel->visible_area.height };
+		}
+	}
+
+	int width = 0;
+	int height = 0;
+
+	_pack_rects(rects, rect_count, &width, &height);
+
+	// Lazy cels get their area now and their pixels the first time they are drawn.
+
+	Image image = GenImageColor(width, height, BLANK);
+
+	if (decoded->flags & ASEPRITE_LOAD_INDEXED)
+		decoded->cels_indices = _gen_index_image(width, height, decoded->transparent_index);
+
+	for (int r = 0; r < rect_count; r++)
+	{
+		int j = rects[r].id / frame_count;
+		int i = rects[r].id % frame_count;
+
+		AseDecodedCel *cel = &decoded->layers[j].cels[i];
+
+		if (!(decoded->flags & ASEPRITE_LOAD_LAZY_CELS))
+		{
+			Color *pixels = (Color *)image.data + (size_t)rects[r].y * width + rects[r].x;
+
+			_copy_cel_area(cute_ase, _find_cute_cel(cute_ase, j, i), cel->visible_area, pixels, width);
+
+			if (decoded->flags & ASEPRITE_LOAD_INDEXED)
+			{
+				unsigned char *indices = (unsigned char *)decoded->cels_indices.data + (size_t)rects[r].y * width + rects[r].x;
+
+				_copy_cel_indices(_find_cute_cel(cute_ase, j, i), cel->visible_area, indices, width);
+			}
+		}
+
+		cel->visible_area.x = rects[r].x;
+		cel->visible_area.y = rects[r].y;
+	}
+
+	for (int j = 0; j < cute_ase->layer_count; j++)
+	{
+		for (int i = 0; i < frame_count; i++)
+		{
+			AseDecodedCel *cel = &decoded->layers[j].cels[i];
+
+			if (cel->active && cel->is_linked)
+				cel->visible_area = decoded->layers[j].cels[cel->linked_frame].visible_area;
+		}
+	}
+
+	free(rects);
+
+	decoded->cels_image = image;
+}
+Image _decode_cel_image(ase_t *cute_ase, ase_cel_t *cute_cel)
+{
+	if (cute_cel->pixels == NULL)
+		return (Image){0};
+
+	Image image = {
+		.width = cute_cel->w,
+		.height = cute_cel->h,
+		.mipmaps = 1,
+		.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+		.data = malloc((size_t)cute_cel->w * cute_cel->h * sizeof(Color))
+	};
+
+	// Cels keep the color mode of the file, grayscale and indexed ones are expanded here.
+
+	cute_aseprite_pixels_to_rgba(cute_ase, cute_cel->pixels, (ase_color_t *)image.data, cute_cel->w * cute_cel->h);
+
+	return image;
+}
+void _copy_cel_area(ase_t *cute_ase, ase_cel_t *cute_cel, Rectangle area, Color *pixels, int stride)
+{
+	Image image = _decode_cel_image(cute_ase, cute_cel);
+
+	if (image.data == NULL)
+		return;
+
+	for (int y = 0; y < (int)area.height; y++)
+	{
+		const Color *row = (const Color *)image.data + (size_t)((int)area.y + y) * image.width + (int)area.x;
+
+		memcpy(pixels + (size_t)y * stride, row, (int)area.width * sizeof(Color));
+	}
+
+	UnloadImage(image);
+}
+void _copy_cel_indices(ase_cel_t *cute_cel, Rectangle area, unsigned char *indices, int stride)
+{
+	// The cels of indexed files hold one palette index per pixel already.
+
+	if (cute_cel->pixels == NULL)
+		return;
+
+	for (int y = 0; y < (int)area.height; y++)
+	{
+		const unsigned char *row = (const unsigned char *)cute_cel->pixels + (size_t)((int)area.y + y) * cute_cel->w + (int)area.x;
+
+		memcpy(indices + (size_t)y * stride, row, (int)area.width);
+	}
+}
+ase_cel_t *_find_cute_cel(ase_t *cute_ase, int layer, int frame)
+{
+	ase_frame_t *cute_frame = &cute_ase->frames[frame];
+
+	for (int k = 0; k < cute_frame->cel_count; k++)
+	{
+		if (cute_frame->cels[k].layer == &cute_ase->layers[layer])
+			return &cute_frame->cels[k];
+	}
+
+	return NULL;
+}
+int _find_linked_cel(ase_t *cute_ase, ase_cel_t **cute_cel)
+{
+	ase_cel_t *cel = *cute_cel;
+	int frame = -1;
+
+	// Follow the links to the cel holding the pixels, giving up on links that go in circles.
+
+	for (int hops = 0; cel->is_linked && hops < cute_ase->frame_count; hops++)
+	{
+		frame = cel->linked_frame_index;
+
+		if (frame >= cute_ase->frame_count)
+			return -1;
+
+		ase_frame_t *cute_frame = &cute_ase->frames[frame];
+		ase_cel_t *source = NULL;
+
+		for (int k = 0; k < cute_frame->cel_count; k++)
+		{
+			if (cute_frame->cels[k].layer == cel->layer)
+			{
+				source = &cute_frame->cels[k];
+				break;
+			}
+		}
+
+		if (source == NULL)
+			return -1;
+
+		cel = source;
+	}
+
+	if (cel->is_linked)
+		return -1;
+
+	*cute_cel = cel;
+
+	return frame;
+}
+int _blends_palette_colors(ase_t *cute_ase)
+{
+	for (int i = 0; i < cute_ase->palette.entry_count; i++)
+	{
+		if (i != cute_ase->transparent_palette_entry_index && cute_ase->palette.entries[i].color.a < 255)
+			return 1;
+	}
+
+	for (int i = 0; i < cute_ase->frame_count; i++)
+	{
+		ase_frame_t *cute_frame = &cute_ase->frames[i];
+
+		for (int k = 0; k < cute_frame->cel_count; k++)
+		{
+			ase_cel_t *cel = &cute_frame->cels[k];
+
+			// Same cels and opacity that cute_aseprite composites frames with.
+
+			if (!(cel->layer->flags & ASE_LAYER_FLAGS_VISIBLE) || (cel->layer->parent && !(cel->layer->parent->flags & ASE_LAYER_FLAGS_VISIBLE)))
+				continue;
+
+			if (cel->is_linked && _find_linked_cel(cute_ase, &cel) < 0)
+				continue;
+
+			unsigned char opacity = (unsigned char)(cel->opacity * cel->layer->opacity * 255.0f);
+
+			if (opacity > 0 && opacity < 255)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+void _load_lazy_cel(Aseprite ase, int layer, int frame)
+{
+	AseCel *cel = &ase.layers[layer].cels[frame];
+
+	if (cel->loaded || !cel->active || ase.source == NULL)
+		return;
+
+	cel->loaded = 1;
+
+	if (cel->is_linked)
+	{
+		_load_lazy_cel(ase, layer, cel->linked_frame);
+		return;
+	}
+
+	ase_t *cute_ase = (ase_t *)ase.source;
+	ase_cel_t *cute_cel = _find_cute_cel(cute_ase, layer, frame);
+
+	if (cute_cel == NULL || cel->visible_area.width <= 0)
+		return;
+
+	cute_aseprite_decode_cel(cute_ase, cute_cel);
+
+	// Fill the area the cel was given in the atlas when it was uploaded.
+
+	Rectangle area =
+	{
+		cute_cel->x < 0 ? -cute_cel->x : 0,
+		cute_cel->y < 0 ? -cute_cel->y : 0,
+		cel->visible_area.width,
+		cel->visible_area.height
+	};
+
+	Color *pixels = (Color *)malloc((size_t)area.width * area.height * sizeof(Color));
+
+	_copy_cel_area(cute_ase, cute_cel, area, pixels, area.width);
+
+	_update_texture_area(ase, _ASE_CELS_ATLAS, cel->visible_area, pixels);
+
+	free(pixels);
+
+	if (ase.flags & ASEPRITE_LOAD_INDEXED)
+	{
+		unsigned char *indices = (unsigned char *)ase.cels_indices.data + (size_t)cel->visible_area.y * ase.cels_indices.width + (int)cel->visible_area.x;
+
+		_copy_cel_indices(cute_cel, area, indices, ase.cels_indices.width);
+	}
+
+	// The texture owns the pixels from now on.
+
+	free(cute_cel->pixels);
+	cute_cel->pixels = NULL;
+}
+void _decode_aseprite_tags(ase_t *cute_ase, AseDecoded *decoded)
+{
+	decoded->tag_count = cute_ase->tag_count;
+	decoded->tags = (AseTag *)malloc(sizeof(AseTag) * cute_ase->tag_count);
+
+	for (int i = 0; i < cute_ase->tag_count; i++)
+	{
+		ase_tag_t tag = (cute_ase->tags)[i];
+
+		decoded->tags[i].id = i;
+		decoded->tags[i].name = strdup(tag.name);
+
+		decoded->tags[i].color =
+		(Color){
+			.r = tag.r,
+			.g = tag.g,
+			.b = tag.b,
+			.a = 255
+		};
+
+		decoded->tags[i].anim_direction = tag.loop_animation_direction & 1;
+		decoded->tags[i].ping_pong = (tag.loop_animation_direction & 2) >> 1;
+
+		decoded->tags[i].from_frame = tag.from_frame;
+		decoded->tags[i].to_frame = tag.to_frame;
+
+		decoded->tags[i].repeat = tag.repeat;
+		decoded->tags[i].loop = !tag.repeat;
+	}
+}
+void _decode_aseprite_palette(ase_t *cute_ase, AseDecoded *decoded)
+{
+	decoded->color_count = cute_ase->palette.entry_count;
+	decoded->palette = (Color *)malloc(decoded->color_count * sizeof(Color));
+
+	for (int u = 0; u < decoded->color_count; u++)
+	{
+		Color *color = &decoded->palette[u];
+		ase_color_t cute = cute_ase->palette.entries[u].color;
+
+		color->r = cute.r;
+		color->g = cute.g;
+		color->b = cute.b;
+		color->a = cute.a;
+	}
+}
+
+AseDecoded DecodeAsepriteFromFile(const char *filename, AseLoadFlags flags)
+{
+	if (flags == 0)
+		return (AseDecoded){0};
+
+	ase_error_t error = ASE_ERROR_NONE;
+
+	ase_t *cute_ase = cute_aseprite_load_from_file_ex(filename, _cute_load_flags(flags), &error, NULL);
+
+	return _decode_aseprite(cute_ase, flags, error);
+}
+AseDecoded DecodeAsepriteFromMemory(const void *data, int size, AseLoadFlags flags)
+{
+	if (flags == 0)
+		return (AseDecoded){0};
+
+	ase_error_t error = ASE_ERROR_NONE;
+
+	ase_t *cute_ase = cute_aseprite_load_from_memory_ex(data, size, _cute_load_flags(flags), &error, NULL);
+
+	return _decode_aseprite(cute_ase, flags, error);
+}
+AseDecoded DecodeAsepriteFromStream(AseReadCallback read, void *user_data, AseLoadFlags flags)
+{
+	if (flags == 0 || read == NULL)
+		return (AseDecoded){0};
+
+	ase_error_t error = ASE_ERROR_NONE;
+
+	ase_t *cute_ase = cute_aseprite_load_from_stream(read, user_data, _cute_load_flags(flags), &error, NULL);
+
+	return _decode_aseprite(cute_ase, flags, error);
+}
+Aseprite UploadAseprite(AseDecoded decoded)
+{
+	return _upload_aseprite(decoded, 1);
+}
+Aseprite _upload_aseprite(AseDecoded decoded, int owns_pixels)
+{
+	if (decoded.flags == 0)
+		return (Aseprite){ .error = decoded.error };
+
+	Aseprite ase = {0};
+
+	ase.flags = decoded.flags;
+	ase.error = decoded.error;
+
+	ase.width = decoded.width;
+	ase.height = decoded.height;
+
+	// Everything but the pixels moves over as is.
+
+	if (decoded.flags & ASEPRITE_LOAD_FRAMES)
+	{
+		ase.frames_texture = LoadTextureFromImage(decoded.frames_image);
+	}
+
+	ase.frames = decoded.frames;
+	ase.frame_count = decoded.frame_count;
+
+	if (decoded.flags & ASEPRITE_LOAD_LAYERS)
+	{
+		ase.cels_texture = LoadTextureFromImage(decoded.cels_image);
+
+		_upload_aseprite_layers(&decoded, &ase);
+	}
+
+	ase.frames_indices = decoded.frames_indices;
+	ase.cels_indices = decoded.cels_indices;
+	ase.transparent_index = decoded.transparent_index;
+
+	// Under a texture budget the pixels stay around to upload the atlases again after an eviction.
+
+	if (_texture_budget > 0)
+	{
+		_manage_textures(&ase, decoded.frames_image, decoded.cels_image, owns_pixels);
+	}
+	else if (owns_pixels)
+	{
+		UnloadImage(decoded.frames_image);
+		UnloadImage(decoded.cels_image);
+	}
+
+	ase.tags = decoded.tags;
+	ase.tag_count = decoded.tag_count;
+
+	ase.palette = decoded.palette;
+	ase.color_count = decoded.color_count;
+
+	ase.source = decoded.source;
+
+	return ase;
+}
+void _upload_aseprite_layers(AseDecoded *decoded, Aseprite *ase)
+{
+	ase->layer_count = decoded->layer_count;
+	ase->layers = (AseLayer *)malloc(decoded->layer_count * sizeof(AseLayer));
+
+	ase->layer_cel_count = decoded->layer_cel_count;
+
+	for (int j = 0; j < decoded->layer_count; j++)
+	{
+		AseDecodedLayer decoded_layer = decoded->layers[j];
+		AseLayer *layer = &ase->layers[j];
+
+		*layer = (AseLayer){
+			.id = decoded_layer.id,
+			.name = decoded_layer.name,
+
+			.opacity = decoded_layer.opacity,
+
+			.cels = calloc(decoded->layer_cel_count, sizeof(AseCel))
+		};
+
+		for (int i = 0; i < decoded->layer_cel_count; i++)
+		{
+			AseDecodedCel decoded_cel = decoded_layer.cels[i];
+
+			if (!decoded_cel.active)
+				continue;
+
+			AseCel cel = {0};
+
+			cel.active = 1;
+
+			cel.opacity = decoded_cel.opacity;
+
+			cel.is_linked = decoded_cel.is_linked;
+			cel.linked_frame = decoded_cel.linked_frame;
+
+			cel.texture = ase->cels_texture;
+			cel.loaded = !(decoded->flags & ASEPRITE_LOAD_LAZY_CELS);
+
+			cel.x_offset = decoded_cel.x_offset;
+			cel.y_offset = decoded_cel.y_offset;
+
+			cel.visible_area = decoded_cel.visible_area;
+
+			layer->cels[i] = cel;
+		}
+
+		free((void *)decoded_layer.cels);
+	}
+
+	free((void *)decoded->layers);
+}
+void UnloadAsepriteDecoded(AseDecoded decoded)
+{
+	UnloadImage(decoded.frames_image);
+	UnloadImage(decoded.cels_image);
+
+	UnloadImage(decoded.frames_indices);
+	UnloadImage(decoded.cels_indices);
+
+	free((void *)decoded.frames);
+
+	for (int j = 0; j < decoded.layer_count; j++)
+	{
+		AseDecodedLayer layer = decoded.layers[j];
+
+		free((void *)layer.name);
+		free((void *)layer.cels);
+	}
+
+	free((void *)decoded.layers);
+
+	for (int i = 0; i < decoded.tag_count; i++)
+		free((void *)decoded.tags[i].name);
+
+	free((void *)decoded.tags);
+	free((void *)decoded.palette);
+
+	if (decoded.source != NULL)
+		cute_aseprite_free((ase_t *)decoded.source);
+}
+
+Aseprite LoadAsepriteFromFile(const char *filename, AseLoadFlags flags)
+{
+	// Lazy cels need the parsed file around and the binary format has no indices, the cache keeps neither.
+
+	if (_cache_directory != NULL && flags != 0 && !(flags & (ASEPRITE_LOAD_LAZY_CELS | ASEPRITE_LOAD_INDEXED)))
+		return _load_aseprite_cached(filename, flags);
+
+	return UploadAseprite(DecodeAsepriteFromFile(filename, flags));
+}
+Aseprite _load_aseprite_cached(const char *filename, AseLoadFlags flags)
+{
+	int size = 0;
+	unsigned char *data = LoadFileData(filename, &size);
+
+	if (data == NULL)
+		return (Aseprite){ .error = ASEPRITE_ERROR_FILE_NOT_FOUND };
+
+	unsigned long long hash = _hash_bytes(data, size);
+	char *path = _cache_path(hash, size, flags, ".aseb");
+
+	// A missing, stale or damaged entry just counts as a miss and gets written again.
+
+	Aseprite ase = LoadAsepriteBinary(path);
+
+	if (IsAsepriteReady(ase))
+	{
+		UnloadFileData(data);
+		free(path);
+
+		return ase;
+	}
+
+	AseDecoded decoded = DecodeAsepriteFromMemory(data, size, flags);
+
+	UnloadFileData(data);
+
+	// Written under a name no other writer uses, then renamed so readers never see a partial file.
+
+	if (decoded.flags != 0 && decoded.error == ASEPRITE_ERROR_NONE)
+	{
+		int stack_marker = 0;
+		char suffix[64];
+
+		sprintf(suffix, ".%d.%llx.tmp", (int)getpid(), (unsigned long long)(size_t)&stack_marker);
+
+		char *temp_path = _cache_path(hash, size, flags, suffix);
+
+		if (ExportAsepriteBinary(decoded, temp_path) && rename(temp_path, path) != 0)
+			remove(temp_path);
+
+		free(temp_path);
+	}
+
+	free(path);
+
+	return UploadAseprite(decoded);
+}
+char *_cache_path(unsigned long long hash, int size, AseLoadFlags flags, const char *suffix)
+{
+	// The key is the source bytes and the sections loaded, the format version is checked on load.
+
+	char *path = (char *)malloc(strlen(_cache_directory) + strlen(suffix) + 48);
+
+	sprintf(path, "%s/%016llx-%x-%x%s", _cache_directory, hash, size, flags & ASEPRITE_LOAD_ALL, suffix);
+
+	return path;
+}
+Aseprite LoadAsepriteFromMemory(const void *data, int size, AseLoadFlags flags)
+{
+	return UploadAseprite(DecodeAsepriteFromMemory(data, size, flags));
+}
+Aseprite LoadAsepriteFromStream(AseReadCallback read, void *user_data, AseLoadFlags flags)
+{
+	return UploadAseprite(DecodeAsepriteFromStream(read, user_data, flags));
+}
+int LoadAsepriteBatch(const char **filenames, int count, AseLoadFlags flags, Aseprite *aseprites)
+{
+	if (count <= 0)
+		return 0;
+
+	_AseBatch batch =
+	{
+		.filenames = filenames,
+		.flags = flags,
+		.decoded = (AseDecoded *)calloc(count, sizeof(AseDecoded))
+	};
+
+	// Parsing, inflating, compositing and packing the atlases run on the worker threads.
+
+	s_parallel_for(count, _decode_batch_job, &batch);
+
+	// Textures can only be created on the thread owning the GL context.
+
+	int loaded = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		aseprites[i] = UploadAseprite(batch.decoded[i]);
+
+		if (IsAsepriteReady(aseprites[i]))
+			loaded++;
+	}
+
+	free(batch.decoded);
+
+	return loaded;
+}
+void _decode_batch_job(int index, void *udata)
+{
+	_AseBatch *batch = (_AseBatch *)udata;
+
+	batch->decoded[index] = DecodeAsepriteFromFile(batch->filenames[index], batch->flags);
+}
+void UnloadAseprite(Aseprite ase)
+{
+	// Atlases under the texture budget may already be evicted, their residency knows.
+
+	if (ase.residency != NULL)
+		_unmanage_textures(ase);
+
+	if ((ase.flags & ASEPRITE_LOAD_FRAMES) && ase.residency == NULL)
+	{
+		UnloadTexture(ase.frames_texture);
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_LAYERS)
+	{
+		if (ase.residency == NULL)
+			UnloadTexture(ase.cels_texture);
+
+		for (int j = 0; j < ase.layer_count; j++)
+		{
+			AseLayer layer = ase.layers[j];
+
+			free((void *)layer.name);
+			free((void *)layer.cels);
+		}
+
+		free((void *)ase.layers);
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_TAGS)
+	{
+		for (int i = 0; i < ase.tag_count; i++)
+		{
+			AseTag tag = ase.tags[i];
+
+			free((void *)tag.name);
+		}
+
+		free((void *)ase.tags);
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_PALETTE)
+	{
+		free((void *)ase.palette);
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_INDEXED)
+	{
+		UnloadImage(ase.frames_indices);
+		UnloadImage(ase.cels_indices);
+	}
+
+	free((void *)ase.frames);
+
+	if (ase.source != NULL)
+		cute_aseprite_free((ase_t *)ase.source);
+}
+
+void SetAsepriteInflateCallback(AseInflateCallback callback)
+{
+	_inflate_callback = callback;
+
+	cute_aseprite_set_inflate(callback ? _aseprite_inflate : NULL, NULL);
+}
+void SetAsepriteCacheDirectory(const char *directory)
+{
+	free(_cache_directory);
+
+	_cache_directory = directory ? strdup(directory) : NULL;
+}
+int _aseprite_inflate(const void *data, int data_size, void *pixels, int pixels_size, void *udata)
+{
+	(void)udata;
+
+	return _inflate_callback(data, data_size, pixels, pixels_size);
+}
+
+int IsAsepriteReady(Aseprite ase)
+{
+	return ase.flags;
+}
+
+// Binary format functions
+
+int ExportAsepriteBinary(AseDecoded decoded, const char *filename)
+{
+	// Lazy cels have no pixels in the atlas yet.
+
+	if (decoded.flags == 0 || (decoded.flags & ASEPRITE_LOAD_LAZY_CELS))
+		return 0;
+
+	size_t strings_size = 0;
+
+	for (int j = 0; j < decoded.layer_count; j++)
+		strings_size += strlen(decoded.layers[j].name ? decoded.layers[j].name : "") + 1;
+
+	for (int i = 0; i < decoded.tag_count; i++)
+		strings_size += strlen(decoded.tags[i].name ? decoded.tags[i].name : "") + 1;
+
+	size_t frames_image_size = decoded.frames_image.data ? (size_t)decoded.frames_image.width * decoded.frames_image.height * sizeof(Color) : 0;
+	size_t cels_image_size = decoded.cels_image.data ? (size_t)decoded.cels_image.width * decoded.cels_image.height * sizeof(Color) : 0;
+
+	size_t metadata_size = (size_t)_binary_metadata_size(decoded.frame_count, decoded.layer_count, decoded.layer_cel_count, decoded.tag_count, decoded.color_count);
+
+	size_t frames_image_offset = (metadata_size + strings_size + 15) & ~(size_t)15;
+	size_t cels_image_offset = (frames_image_offset + frames_image_size + 15) & ~(size_t)15;
+	size_t file_size = cels_image_offset + cels_image_size;
+
+	if (file_size > 0x7FFFFFFF)
+		return 0;
+
+	unsigned char *data = (unsigned char *)calloc(file_size, 1);
+	unsigned char *cursor = data;
+
+	unsigned char *strings = data + metadata_size;
+	unsigned int string_offset = 0;
+
+	_write_u32(&cursor, ASEPRITE_BINARY_MAGIC);
+	_write_u32(&cursor, ASEPRITE_BINARY_VERSION);
+	_write_u32(&cursor, decoded.flags & ASEPRITE_LOAD_ALL);
+	_write_u32(&cursor, decoded.width);
+	_write_u32(&cursor, decoded.height);
+	_write_u32(&cursor, decoded.frame_count);
+	_write_u32(&cursor, decoded.layer_count);
+	_write_u32(&cursor, decoded.layer_cel_count);
+	_write_u32(&cursor, decoded.tag_count);
+	_write_u32(&cursor, decoded.color_count);
+	_write_u32(&cursor, (unsigned int)strings_size);
+	_write_u32(&cursor, frames_image_size ? decoded.frames_image.width : 0);
+	_write_u32(&cursor, frames_image_size ? decoded.frames_image.height : 0);
+	_write_u32(&cursor, (unsigned int)frames_image_offset);
+	_write_u32(&cursor, cels_image_size ? decoded.cels_image.width : 0);
+	_write_u32(&cursor, cels_image_size ? decoded.cels_image.height : 0);
+	_write_u32(&cursor, (unsigned int)cels_image_offset);
+	_write_u32(&cursor, (unsigned int)file_size);
+
+	for (int i = 0; i < decoded.frame_count; i++)
+	{
+		AseFrame frame = decoded.frames[i];
+
+		_write_u32(&cursor, (int)frame.source.x);
+		_write_u32(&cursor, (int)frame.source.y);
+		_write_u32(&cursor, (int)frame.source.width);
+		_write_u32(&cursor, (int)frame.source.height);
+		_write_u32(&cursor, (int)frame.x_offset);
+		_write_u32(&cursor, (int)frame.y_offset);
+		_write_u32(&cursor, frame.duration_milliseconds);
+	}
+
+	for (int j = 0; j < decoded.layer_count; j++)
+	{
+		AseDecodedLayer layer = decoded.layers[j];
+		const char *name = layer.name ? layer.name : "";
+
+		_write_u32(&cursor, string_offset);
+		_write_f32(&cursor, layer.opacity);
+
+		memcpy(strings + string_offset, name, strlen(name) + 1);
+		string_offset += strlen(name) + 1;
+	}
+
+	for (int j = 0; j < decoded.layer_count; j++)
+	{
+		for (int i = 0; i < decoded.layer_cel_count; i++)
+		{
+			AseDecodedCel cel = decoded.layers[j].cels[i];
+
+			_write_u32(&cursor, cel.active);
+			_write_u32(&cursor, cel.is_linked);
+			_write_u32(&cursor, cel.linked_frame);
+			_write_u32(&cursor, (int)cel.x_offset);
+			_write_u32(&cursor, (int)cel.y_offset);
+			_write_u32(&cursor, (int)cel.visible_area.x);
+			_write_u32(&cursor, (int)cel.visible_area.y);
+			_write_u32(&cursor, (int)cel.visible_area.width);
+			_write_u32(&cursor, (int)cel.visible_area.height);
+			_write_f32(&cursor, cel.opacity);
+		}
+	}
+
+	for (int i = 0; i < decoded.tag_count; i++)
+	{
+		AseTag tag = decoded.tags[i];
+		const char *name = tag.name ? tag.name : "";
+
+		_write_u32(&cursor, string_offset);
+		_write_u32(&cursor, tag.color.r | (tag.color.g << 8) | (tag.color.b << 16) | ((unsigned int)tag.color.a << 24));
+		_write_u32(&cursor, tag.anim_direction);
+		_write_u32(&cursor, tag.ping_pong);
+		_write_u32(&cursor, tag.from_frame);
+		_write_u32(&cursor, tag.to_frame);
+		_write_u32(&cursor, tag.repeat);
+		_write_u32(&cursor, tag.loop);
+
+		memcpy(strings + string_offset, name, strlen(name) + 1);
+		string_offset += strlen(name) + 1;
+	}
+
+	if (decoded.color_count > 0)
+		memcpy(cursor, decoded.palette, decoded.color_count * sizeof(Color));
+
+	if (frames_image_size)
+		memcpy(data + frames_image_offset, decoded.frames_image.data, frames_image_size);
+
+	if (cels_image_size)
+		memcpy(data + cels_image_offset, decoded.cels_image.data, cels_image_size);
+
+	int saved = SaveFileData(filename, data, (int)file_size);
+
+	free(data);
+
+	return saved;
+}
+AseDecoded DecodeAsepriteBinaryFromMemory(const void *data, int size)
+{
+	return _read_aseprite_binary((const unsigned char *)data, size, 1);
+}
+Aseprite LoadAsepriteBinaryFromMemory(const void *data, int size)
+{
+	// The atlases are uploaded straight from data, nothing is decompressed, composited or copied.
+
+	return _upload_aseprite(_read_aseprite_binary((const unsigned char *)data, size, 0), 0);
+}
+Aseprite LoadAsepriteBinary(const char *filename)
+{
+	int size = 0;
+
+#if defined(CUTE_ASEPRITE_MMAP)
+	// Cache entries are only ever replaced by a rename, so a mapping can't be truncated under us.
+
+	void *map = s_mmap(filename, &size);
+
+	if (map != NULL)
+	{
+		Aseprite mapped = LoadAsepriteBinaryFromMemory(map, size);
+
+		munmap(map, (size_t)size);
+
+		return mapped;
+	}
+#endif
+
+	unsigned char *data = LoadFileData(filename, &size);
+
+	if (data == NULL)
+		return (Aseprite){ .error = ASEPRITE_ERROR_FILE_NOT_FOUND };
+
+	Aseprite ase = LoadAsepriteBinaryFromMemory(data, size);
+
+	UnloadFileData(data);
+
+	return ase;
+}
+unsigned long long _binary_metadata_size(int frame_count, int layer_count, int layer_cel_count, int tag_count, int color_count)
+{
+	// Everything before the strings: header, frames, layers, cels, tags and palette, in 32-bit fields.
+
+	return 4 * (18 + 7ULL * frame_count + 2ULL * layer_count + 10ULL * layer_count * layer_cel_count + 8ULL * tag_count + color_count);
+}
+AseDecoded _read_aseprite_binary(const unsigned char *data, int size, int copy_pixels)
+{
+	if (data == NULL || size < 18 * 4)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_TRUNCATED };
+
+	const unsigned char *cursor = data;
+
+	unsigned int header[18];
+
+	for (int i = 0; i < 18; i++)
+		header[i] = _read_u32(&cursor);
+
+	if (header[0] != ASEPRITE_BINARY_MAGIC || header[1] != ASEPRITE_BINARY_VERSION)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_INVALID_FILE };
+
+	unsigned int flags = header[2];
+	unsigned int frame_count = header[5];
+	unsigned int layer_count = header[6];
+	unsigned int layer_cel_count = header[7];
+	unsigned int tag_count = header[8];
+	unsigned int color_count = header[9];
+	unsigned int strings_size = header[10];
+
+	unsigned long long frames_image_end = header[13] + 4ULL * header[11] * header[12];
+	unsigned long long cels_image_end = header[16] + 4ULL * header[14] * header[15];
+
+	if (header[17] != (unsigned int)size || frames_image_end > (unsigned int)size || cels_image_end > (unsigned int)size)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_TRUNCATED };
+
+	if (flags == 0 || (flags & ~ASEPRITE_LOAD_ALL) || frame_count > 0xFFFF || layer_count > 0xFFFF || layer_cel_count > 0xFFFF || tag_count > 0xFFFF || color_count > 0xFFFF)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_INVALID_FILE };
+
+	// Sections that were not loaded must be empty, their arrays are only freed when the flag is set.
+
+	if ((!(flags & ASEPRITE_LOAD_FRAMES) && frame_count) || (!(flags & ASEPRITE_LOAD_LAYERS) && layer_count) || (!(flags & ASEPRITE_LOAD_TAGS) && tag_count) || (!(flags & ASEPRITE_LOAD_PALETTE) && color_count))
+		return (AseDecoded){ .error = ASEPRITE_ERROR_INVALID_FILE };
+
+	unsigned long long metadata_size = _binary_metadata_size(frame_count, layer_count, layer_cel_count, tag_count, color_count);
+
+	if (metadata_size + strings_size > (unsigned int)size)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_TRUNCATED };
+
+	const char *strings = (const char *)data + metadata_size;
+
+	if (strings_size > 0 && strings[strings_size - 1] != '\0')
+		return (AseDecoded){ .error = ASEPRITE_ERROR_INVALID_FILE };
+
+	AseDecoded decoded = {0};
+
+	decoded.flags = (AseLoadFlags)flags;
+
+	decoded.width = header[3];
+	decoded.height = header[4];
+
+	decoded.frame_count = frame_count;
+	if (flags & ASEPRITE_LOAD_FRAMES)
+		decoded.frames = (AseFrame *)calloc(frame_count, sizeof(AseFrame));
+
+	for (unsigned int i = 0; i < frame_count; i++)
+	{
+		AseFrame *frame = &decoded.frames[i];
+
+		frame->id = i;
+
+		frame->source.x = (int)_read_u32(&cursor);
+		frame->source.y = (int)_read_u32(&cursor);
+		frame->source.width = (int)_read_u32(&cursor);
+		frame->source.height = (int)_read_u32(&cursor);
+
+		frame->x_offset = (int)_read_u32(&cursor);
+		frame->y_offset = (int)_read_u32(&cursor);
+
+		frame->duration_milliseconds = (int)_read_u32(&cursor);
+	}
+
+	decoded.layer_count = layer_count;
+	decoded.layer_cel_count = layer_cel_count;
+	if (flags & ASEPRITE_LOAD_LAYERS)
+		decoded.layers = (AseDecodedLayer *)calloc(layer_count, sizeof(AseDecodedLayer));
+
+	for (unsigned int j = 0; j < layer_count; j++)
+	{
+		AseDecodedLayer *layer = &decoded.layers[j];
+
+		unsigned int name = _read_u32(&cursor);
+
+		layer->id = j;
+		layer->name = strdup(name < strings_size ? strings + name : "");
+
+		layer->opacity = _read_f32(&cursor);
+
+		layer->cels = (AseDecodedCel *)calloc(layer_cel_count, sizeof(AseDecodedCel));
+	}
+
+	for (unsigned int j = 0; j < layer_count; j++)
+	{
+		for (unsigned int i = 0; i < layer_cel_count; i++)
+		{
+			AseDecodedCel *cel = &decoded.layers[j].cels[i];
+
+			cel->active = (int)_read_u32(&cursor);
+			cel->is_linked = (int)_read_u32(&cursor);
+			cel->linked_frame = (int)_read_u32(&cursor);
+
+			cel->x_offset = (int)_read_u32(&cursor);
+			cel->y_offset = (int)_read_u32(&cursor);
+
+			cel->visible_area.x = (int)_read_u32(&cursor);
+			cel->visible_area.y = (int)_read_u32(&cursor);
+			cel->visible_area.width = (int)_read_u32(&cursor);
+			cel->visible_area.height = (int)_read_u32(&cursor);
+
+			cel->opacity = _read_f32(&cursor);
+
+			if (cel->is_linked && (cel->linked_frame < 0 || cel->linked_frame >= (int)layer_cel_count))
+				cel->active = 0;
+		}
+	}
+
+	// Every rect is drawn from its atlas as is, one reaching outside of it would read past the texture.
+
+	int rects_valid = 1;
+
+	for (unsigned int i = 0; i < frame_count; i++)
+		rects_valid &= _rect_in_image(decoded.frames[i].source, header[11], header[12]);
+
+	for (unsigned int j = 0; j < layer_count; j++)
+	{
+		for (unsigned int i = 0; i < layer_cel_count; i++)
+			rects_valid &= _rect_in_image(decoded.layers[j].cels[i].visible_area, header[14], header[15]);
+	}
+
+	if (!rects_valid)
+	{
+		UnloadAsepriteDecoded(decoded);
+
+		return (AseDecoded){ .error = ASEPRITE_ERROR_INVALID_FILE };
+	}
+
+	decoded.tag_count = tag_count;
+	if (flags & ASEPRITE_LOAD_TAGS)
+		decoded.tags = (AseTag *)calloc(tag_count, sizeof(AseTag));
+
+	for (unsigned int i = 0; i < tag_count; i++)
+	{
+		AseTag *tag = &decoded.tags[i];
+
+		unsigned int name = _read_u32(&cursor);
+		unsigned int color = _read_u32(&cursor);
+
+		tag->id = i;
+		tag->name = strdup(name < strings_size ? strings + name : "");
+
+		tag->color = (Color){ color & 0xFF, (color >> 8) & 0xFF, (color >> 16) & 0xFF, color >> 24 };
+
+		tag->anim_direction = (AseAnimDirection)_read_u32(&cursor);
+		tag->ping_pong = (int)_read_u32(&cursor);
+
+		tag->from_frame = (int)_read_u32(&cursor);
+		tag->to_frame = (int)_read_u32(&cursor);
+
+		tag->repeat = (int)_read_u32(&cursor);
+		tag->loop = (int)_read_u32(&cursor);
+	}
+
+	decoded.color_count = color_count;
+	if (flags & ASEPRITE_LOAD_PALETTE)
+	{
+		decoded.palette = (Color *)malloc(color_count * sizeof(Color));
+
+		memcpy(decoded.palette, cursor, color_count * sizeof(Color));
+	}
+
+	Image *images[2] = { &decoded.frames_image, &decoded.cels_image };
+
+	for (int k = 0; k < 2; k++)
+	{
+		unsigned int width = header[11 + k * 3];
+		unsigned int height = header[12 + k * 3];
+		size_t image_size = (size_t)width * height * sizeof(Color);
+
+		if (image_size == 0)
+			continue;
+
+		void *pixels = (void *)(data + header[13 + k * 3]);
+
+		if (copy_pixels)
+		{
+			pixels = memcpy(malloc(image_size), pixels, image_size);
+		}
+
+		*images[k] = (Image){
+			.width = width,
+			.height = height,
+			.mipmaps = 1,
+			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+			.data = pixels
+		};
+	}
+
+	return decoded;
+}
+
+// Hot reload functions
+
+AseWatch *WatchAseprite(Aseprite *ase, const char *filename)
+{
+	if (ase == NULL || !IsAsepriteReady(*ase))
+		return NULL;
+
+	AseWatch *watch = (AseWatch *)calloc(1, sizeof(AseWatch));
+
+	watch->ase = ase;
+	watch->filename = strdup(filename);
+
+	watch->inotify = -1;
+	watch->mod_time = GetFileModTime(filename);
+
+#if defined(__linux__)
+	// The directory is watched rather than the file, editors often save by renaming a new file over the old one.
+
+	const char *slash = strrchr(filename, '/');
+
+	watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (watch->inotify >= 0)
+	{
+		char *directory = slash ? strdup(filename) : strdup(".");
+
+		if (slash)
+			directory[slash - filename + (slash == filename)] = '\0';
+
+		if (inotify_add_watch(watch->inotify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			close(watch->inotify);
+			watch->inotify = -1;
+		}
+
+		free(directory);
+	}
+#endif
+
+	// Nothing is decoded up front, the textures hold no CPU copy to hash. The first reload uploads
+	// every area and later ones only those that differ from the previous reload.
+
+	return watch;
+}
+
+int ReloadAsepriteIfChanged(AseWatch *watch)
+{
+	if (watch == NULL || !_watched_file_changed(watch))
+		return 0;
+
+	Aseprite *ase = watch->ase;
+
+	AseDecoded decoded = _decode_watched_file(watch);
+
+	// The file may still be half written, keep what is loaded and wait for the next change.
+
+	if (decoded.flags == 0)
+	{
+		UnloadAsepriteDecoded(decoded);
+		return 0;
+	}
+
+	unsigned long long *frame_hashes = NULL;
+	unsigned long long *cel_hashes = NULL;
+
+	_hash_decoded(&decoded, &frame_hashes, &cel_hashes);
+
+	if (_reload_in_place(watch, &decoded, frame_hashes, cel_hashes))
+	{
+		UnloadAsepriteDecoded(decoded);
+	}
+	else
+	{
+		// The atlases were laid out differently, start over in the same Aseprite so animations keep working.
+		// They clamp themselves to the new frames, but their tag copies still point at the old names.
+
+		_keep_old_tag_names(watch);
+
+		UnloadAseprite(*ase);
+
+		*ase = UploadAseprite(decoded);
+	}
+
+	free(watch->frame_hashes);
+	free(watch->cel_hashes);
+
+	watch->frame_hashes = frame_hashes;
+	watch->cel_hashes = cel_hashes;
+
+	return 1;
+}
+void UnwatchAseprite(AseWatch *watch)
+{
+	if (watch == NULL)
+		return;
+
+#if defined(__linux__)
+	if (watch->inotify >= 0)
+		close(watch->inotify);
+#endif
+
+	for (int i = 0; i < watch->old_tag_name_count; i++)
+		free(watch->old_tag_names[i]);
+
+	free(watch->old_tag_names);
+
+	free(watch->filename);
+	free(watch->frame_hashes);
+	free(watch->cel_hashes);
+	free(watch);
+}
+int _watched_file_changed(AseWatch *watch)
+{
+#if defined(__linux__)
+	if (watch->inotify >= 0)
+	{
+		const char *slash = strrchr(watch->filename, '/');
+		const char *name = slash ? slash + 1 : watch->filename;
+
+		union
+		{
+			struct inotify_event event;
+			char bytes[4096];
+		} buffer;
+
+		int changed = 0;
+		ssize_t length;
+
+		while ((length = read(watch->inotify, &buffer, sizeof(buffer))) > 0)
+		{
+			for (char *cursor = buffer.bytes; cursor < buffer.bytes + length; )
+			{
+				struct inotify_event *event = (struct inotify_event *)cursor;
+
+				if (event->len > 0 && strcmp(event->name, name) == 0)
+					changed = 1;
+
+				cursor += sizeof(struct inotify_event) + event->len;
+			}
+		}
+
+		return changed;
+	}
+#endif
+
+	long mod_time = GetFileModTime(watch->filename);
+
+	if (mod_time == watch->mod_time)
+		return 0;
+
+	watch->mod_time = mod_time;
+
+	return 1;
+}
+AseDecoded _decode_watched_file(AseWatch *watch)
+{
+	// Read rather than mapped, the editor may truncate the file while it is parsed and a mapping
+	// would fault. A half written copy just fails to decode.
+
+	int size = 0;
+	unsigned char *data = LoadFileData(watch->filename, &size);
+
+	if (data == NULL)
+		return (AseDecoded){ .error = ASEPRITE_ERROR_FILE_NOT_FOUND };
+
+	AseDecoded decoded = DecodeAsepriteFromMemory(data, size, watch->ase->flags);
+
+	UnloadFileData(data);
+
+	return decoded;
+}
+int _reload_in_place(AseWatch *watch, AseDecoded *decoded, unsigned long long *frame_hashes, unsigned long long *cel_hashes)
+{
+	Aseprite *ase = watch->ase;
+
+	// Everything has to land where it already is: same atlases, same rectangles, same tags.
+
+	if (decoded->flags != ase->flags || decoded->width != ase->width || decoded->height != ase->height)
+		return 0;
+
+	if (decoded->frame_count != ase->frame_count || decoded->layer_count != ase->layer_count || decoded->layer_cel_count != ase->layer_cel_count)
+		return 0;
+
+	if (decoded->tag_count != ase->tag_count || decoded->color_count != ase->color_count)
+		return 0;
+
+	if (decoded->frames_image.width != ase->frames_texture.width || decoded->frames_image.height != ase->frames_texture.height)
+		return 0;
+
+	if (decoded->cels_image.width != ase->cels_texture.width || decoded->cels_image.height != ase->cels_texture.height)
+		return 0;
+
+	for (int i = 0; i < decoded->frame_count; i++)
+	{
+		AseFrame frame = decoded->frames[i];
+		AseFrame old_frame = ase->frames[i];
+
+		if (memcmp(&frame.source, &old_frame.source, sizeof(Rectangle)) != 0 || frame.x_offset != old_frame.x_offset || frame.y_offset != old_frame.y_offset)
+			return 0;
+	}
+
+	for (int j = 0; j < decoded->layer_count; j++)
+	{
+		for (int i = 0; i < decoded->layer_cel_count; i++)
+		{
+			AseDecodedCel cel = decoded->layers[j].cels[i];
+			AseCel old_cel = ase->layers[j].cels[i];
+
+			if (cel.active != old_cel.active || cel.is_linked != old_cel.is_linked || cel.linked_frame != old_cel.linked_frame)
+				return 0;
+
+			if (cel.x_offset != old_cel.x_offset || cel.y_offset != old_cel.y_offset || memcmp(&cel.visible_area, &old_cel.visible_area, sizeof(Rectangle)) != 0)
+				return 0;
+		}
+	}
+
+	// Animations hold a copy of their tag, so its name must stay alive.
+
+	for (int i = 0; i < decoded->tag_count; i++)
+	{
+		if (strcmp(decoded->tags[i].name, ase->tags[i].name) != 0)
+			return 0;
+	}
+
+	for (int i = 0; i < decoded->frame_count; i++)
+	{
+		ase->frames[i].duration_milliseconds = decoded->frames[i].duration_milliseconds;
+
+		if (watch->frame_hashes != NULL && frame_hashes[i] == watch->frame_hashes[i])
+			continue;
+
+		// Identical frames share their area, it only needs uploading once.
+
+		int shared = 0;
+
+		for (int k = 0; k < i && !shared; k++)
+			shared = memcmp(&decoded->frames[k].source, &decoded->frames[i].source, sizeof(Rectangle)) == 0;
+
+		if (!shared)
+			_reload_area(ase, _ASE_FRAMES_ATLAS, decoded->frames_image, decoded->frames[i].source);
+	}
+
+	for (int j = 0; j < decoded->layer_count; j++)
+	{
+		AseDecodedLayer *layer = &decoded->layers[j];
+		AseLayer *old_layer = &ase->layers[j];
+
+		old_layer->opacity = layer->opacity;
+
+		// Swapped rather than copied, unloading decoded frees the old name.
+
+		const char *name = old_layer->name;
+
+		old_layer->name = layer->name;
+		layer->name = name;
+
+		for (int i = 0; i < decoded->layer_cel_count; i++)
+		{
+			AseDecodedCel cel = layer->cels[i];
+			AseCel *old_cel = &old_layer->cels[i];
+
+			old_cel->opacity = cel.opacity;
+
+			// Lazy cels are decoded again from the new file the next time they are drawn.
+
+			if (ase->flags & ASEPRITE_LOAD_LAZY_CELS)
+			{
+				old_cel->loaded = 0;
+				continue;
+			}
+
+			int index = j * decoded->layer_cel_count + i;
+
+			if (cel.active && !cel.is_linked && (watch->cel_hashes == NULL || cel_hashes[index] != watch->cel_hashes[index]))
+				_reload_area(ase, _ASE_CELS_ATLAS, decoded->cels_image, cel.visible_area);
+		}
+	}
+
+	for (int i = 0; i < decoded->tag_count; i++)
+	{
+		AseTag tag = decoded->tags[i];
+
+		tag.name = ase->tags[i].name;
+
+		ase->tags[i] = tag;
+	}
+
+	if (decoded->color_count > 0)
+		memcpy(ase->palette, decoded->palette, decoded->color_count * sizeof(Color));
+
+	// Swapped too, so palette changes start from the new indices. Those of lazy cels fill in as they load.
+
+	if (ase->flags & ASEPRITE_LOAD_INDEXED)
+	{
+		// Atlases under the budget kept as the old indices need colors of their own before those go.
+
+		if (ase->residency != NULL)
+		{
+			_unindex_texture(&((_AseResidentTexture *)ase->residency)[_ASE_FRAMES_ATLAS]);
+			_unindex_texture(&((_AseResidentTexture *)ase->residency)[_ASE_CELS_ATLAS]);
+		}
+
+		Image frames_indices = ase->frames_indices;
+		Image cels_indices = ase->cels_indices;
+
+		ase->frames_indices = decoded->frames_indices;
+		ase->cels_indices = decoded->cels_indices;
+
+		decoded->frames_indices = frames_indices;
+		decoded->cels_indices = cels_indices;
+
+		ase->transparent_index = decoded->transparent_index;
+	}
+
+	if (ase->flags & ASEPRITE_LOAD_LAZY_CELS)
+	{
+		void *source = ase->source;
+
+		ase->source = decoded->source;
+		decoded->source = source;
+	}
+
+	ase->error = decoded->error;
+
+	return 1;
+}
+void _keep_old_tag_names(AseWatch *watch)
+{
+	Aseprite *ase = watch->ase;
+
+	if (ase->tag_count == 0)
+		return;
+
+	watch->old_tag_names = (char **)realloc(watch->old_tag_names, (watch->old_tag_name_count + ase->tag_count) * sizeof(char *));
+
+	// Taken out of the tags so UnloadAseprite() leaves them alone, UnwatchAseprite() frees them.
+
+	for (int i = 0; i < ase->tag_count; i++)
+	{
+		watch->old_tag_names[watch->old_tag_name_count++] = (char *)ase->tags[i].name;
+
+		ase->tags[i].name = NULL;
+	}
+}
+void _hash_decoded(AseDecoded *decoded, unsigned long long **frame_hashes, unsigned long long **cel_hashes)
+{
+	*frame_hashes = (unsigned long long *)calloc(decoded->frame_count + 1, sizeof(unsigned long long));
+	*cel_hashes = (unsigned long long *)calloc((size_t)decoded->layer_count * decoded->layer_cel_count + 1, sizeof(unsigned long long));
+
+	for (int i = 0; i < decoded->frame_count; i++)
+		(*frame_hashes)[i] = _hash_image_area(decoded->frames_image, decoded->frames[i].source);
+
+	// The cels atlas is still blank with lazy cels, they get no hashes.
+
+	if (decoded->flags & ASEPRITE_LOAD_LAZY_CELS)
+		return;
+
+	for (int j = 0; j < decoded->layer_count; j++)
+	{
+		for (int i = 0; i < decoded->layer_cel_count; i++)
+		{
+			AseDecodedCel cel = decoded->layers[j].cels[i];
+
+			if (cel.active && !cel.is_linked)
+				(*cel_hashes)[j * decoded->layer_cel_count + i] = _hash_image_area(decoded->cels_image, cel.visible_area);
+		}
+	}
+}
+unsigned long long _hash_image_area(Image image, Rectangle area)
+{
+	unsigned long long hash = 0;
+
+	for (int y = 0; y < (int)area.height; y++)
+	{
+		const Color *row = (const Color *)image.data + ((int)area.y + y) * image.width + (int)area.x;
+
+		hash = (hash ^ _hash_bytes(row, (size_t)area.width * sizeof(Color))) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+void _reload_area(Aseprite *ase, _AseAtlas atlas, Image image, Rectangle area)
+{
+	Color *pixels = (Color *)malloc((size_t)area.width * area.height * sizeof(Color) + 1);
+
+	_copy_image_area(image, area, pixels);
+
+	_update_texture_area(*ase, atlas, area, pixels);
+
+	free(pixels);
+}
+void _copy_image_area(Image image, Rectangle area, Color *pixels)
+{
+	for (int y = 0; y < (int)area.height; y++)
+	{
+		const Color *row = (const Color *)image.data + ((int)area.y + y) * image.width + (int)area.x;
+
+		memcpy(pixels + y * (int)area.width, row, (size_t)area.width * sizeof(Color));
+	}
+}
+
+// Shared registry functions
+
+Aseprite *AcquireAseprite(const char *filename, AseLoadFlags flags)
+{
+	_lock_registry();
+
+	_AseRegistryEntry *entry = _registry;
+
+	while (entry != NULL && (entry->flags != flags || strcmp(entry->filename, filename) != 0))
+		entry = entry->next;
+
+	if (entry != NULL)
+	{
+		entry->references++;
+
+		// Another thread may still be loading it, sleep until it is done.
+
+		while (!entry->loaded)
+			_wait_registry();
+
+		// A failed load was already taken out of the registry, the last one to see it frees it.
+
+		if (!IsAsepriteReady(entry->ase))
+		{
+			int last = --entry->references == 0;
+
+			_unlock_registry();
+
+			if (last)
+				_drop_registry_entry(entry);
+
+			return NULL;
+		}
+
+		_unlock_registry();
+
+		return &entry->ase;
+	}
+
+	entry = (_AseRegistryEntry *)calloc(1, sizeof(_AseRegistryEntry));
+
+	entry->filename = strdup(filename);
+	entry->flags = flags;
+	entry->references = 1;
+
+	entry->next = _registry;
+	_registry = entry;
+
+	_unlock_registry();
+
+	// Loaded outside the lock, other files can be acquired and released meanwhile. This uploads
+	// textures and updates the texture budget, neither of which is locked, hence the GL thread.
+
+	Aseprite ase = LoadAsepriteFromFile(filename, flags);
+
+	_lock_registry();
+
+	entry->ase = ase;
+	entry->loaded = 1;
+
+	int failed = !IsAsepriteReady(ase);
+	int last = 0;
+
+	// Not kept around on failure, the next acquire tries to load the file again.
+
+	if (failed)
+	{
+		_AseRegistryEntry **link = &_registry;
+
+		while (*link != entry)
+			link = &(*link)->next;
+
+		*link = entry->next;
+
+		last = --entry->references == 0;
+	}
+
+	_wake_registry();
+	_unlock_registry();
+
+	if (last)
+		_drop_registry_entry(entry);
+
+	return failed ? NULL : &entry->ase;
+}
+void ReleaseAseprite(Aseprite *ase)
+{
+	if (ase == NULL)
+		return;
+
+	_lock_registry();
+
+	_AseRegistryEntry **link = &_registry;
+
+	while (*link != NULL && &(*link)->ase != ase)
+		link = &(*link)->next;
+
+	_AseRegistryEntry *entry = *link;
+
+	if (entry != NULL && --entry->references == 0)
+		*link = entry->next;
+	else
+		entry = NULL;
+
+	_unlock_registry();
+
+	if (entry == NULL)
+		return;
+
+	_drop_registry_entry(entry);
+}
+void _lock_registry(void)
+{
+#if defined(_WIN32)
+	AcquireSRWLockExclusive(&_registry_lock);
+#else
+	pthread_mutex_lock(&_registry_lock);
+#endif
+}
+void _unlock_registry(void)
+{
+#if defined(_WIN32)
+	ReleaseSRWLockExclusive(&_registry_lock);
+#else
+	pthread_mutex_unlock(&_registry_lock);
+#endif
+}
+void _wait_registry(void)
+{
+	// Releases the registry lock while asleep and holds it again on return.
+
+#if defined(_WIN32)
+	SleepConditionVariableSRW(&_registry_loaded, &_registry_lock, 0xFFFFFFFF, 0);
+#else
+	pthread_cond_wait(&_registry_loaded, &_registry_lock);
+#endif
+}
+void _wake_registry(void)
+{
+#if defined(_WIN32)
+	WakeAllConditionVariable(&_registry_loaded);
+#else
+	pthread_cond_broadcast(&_registry_loaded);
+#endif
+}
+void _drop_registry_entry(_AseRegistryEntry *entry)
+{
+	UnloadAseprite(entry->ase);
+
+	free(entry->filename);
+	free(entry);
+}
+
+// Palette functions
+
+Aseprite LoadAsepriteVariant(Aseprite ase, const Color *palette, int color_count)
+{
+	if (!(ase.flags & ASEPRITE_LOAD_INDEXED))
+		return (Aseprite){0};
+
+	// Every cel needs its indices before they can be copied, the variant has no file to decode from.
+
+	_load_lazy_cels(ase);
+
+	Color lut[256];
+
+	_build_palette_lut(lut, palette, color_count, ase.transparent_index);
+
+	// Goes through the same upload as a decoded file, sharing nothing with ase.
+
+	AseDecoded decoded = {0};
+
+	decoded.flags = ase.flags & ~ASEPRITE_LOAD_LAZY_CELS;
+	decoded.error = ase.error;
+
+	decoded.width = ase.width;
+	decoded.height = ase.height;
+
+	decoded.transparent_index = ase.transparent_index;
+
+	if (ase.flags & ASEPRITE_LOAD_FRAMES)
+	{
+		decoded.frames_image = _expand_indices(ase.frames_indices, lut);
+		decoded.frames_indices = ImageCopy(ase.frames_indices);
+
+		decoded.frame_count = ase.frame_count;
+		decoded.frames = (AseFrame *)malloc(ase.frame_count * sizeof(AseFrame));
+
+		memcpy(decoded.frames, ase.frames, ase.frame_count * sizeof(AseFrame));
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_LAYERS)
+	{
+		decoded.cels_image = _expand_indices(ase.cels_indices, lut);
+		decoded.cels_indices = ImageCopy(ase.cels_indices);
+
+		decoded.layer_count = ase.layer_count;
+		decoded.layer_cel_count = ase.layer_cel_count;
+		decoded.layers = (AseDecodedLayer *)malloc(ase.layer_count * sizeof(AseDecodedLayer));
+
+		for (int j = 0; j < ase.layer_count; j++)
+		{
+			AseLayer layer = ase.layers[j];
+
+			decoded.layers[j] = (AseDecodedLayer){
+				.id = layer.id,
+				.name = strdup(layer.name),
+
+				.opacity = layer.opacity,
+
+				.cels = calloc(ase.layer_cel_count, sizeof(AseDecodedCel))
+			};
+
+			for (int i = 0; i < ase.layer_cel_count; i++)
+			{
+				AseCel cel = layer.cels[i];
+
+				decoded.layers[j].cels[i] = (AseDecodedCel){
+					.active = cel.active,
+
+					.is_linked = cel.is_linked,
+					.linked_frame = cel.linked_frame,
+
+					.x_offset = cel.x_offset,
+					.y_offset = cel.y_offset,
+
+					.visible_area = cel.visible_area,
+
+					.opacity = cel.opacity
+				};
+			}
+		}
+	}
+
+	if (ase.flags & ASEPRITE_LOAD_TAGS)
+	{
+		decoded.tag_count = ase.tag_count;
+		decoded.tags = (AseTag *)malloc(ase.tag_count * sizeof(AseTag));
+
+		for (int i = 0; i < ase.tag_count; i++)
+		{
+			decoded.tags[i] = ase.tags[i];
+			decoded.tags[i].name = strdup(ase.tags[i].name);
+		}
+	}
+
+	// The palette stays the one of the file, like it does after SetAsepritePalette().
+
+	if (ase.flags & ASEPRITE_LOAD_PALETTE)
+	{
+		decoded.color_count = ase.color_count;
+		decoded.palette = (Color *)malloc(ase.color_count * sizeof(Color));
+
+		memcpy(decoded.palette, ase.palette, ase.color_count * sizeof(Color));
+	}
+
+	return UploadAseprite(decoded);
+}
+void SetAsepritePalette(Aseprite ase, const Color *palette, int color_count)
+{
+	if (!(ase.flags & ASEPRITE_LOAD_INDEXED))
+		return;
+
+	// Lazy cels loaded later would come in with the colors of the file.
+
+	_load_lazy_cels(ase);
+
+	Color lut[256];
+
+	_build_palette_lut(lut, palette, color_count, ase.transparent_index);
+
+	if (ase.flags & ASEPRITE_LOAD_FRAMES)
+		_recolor_atlas(ase, _ASE_FRAMES_ATLAS, ase.frames_indices, lut);
+
+	if (ase.flags & ASEPRITE_LOAD_LAYERS)
+		_recolor_atlas(ase, _ASE_CELS_ATLAS, ase.cels_indices, lut);
+}
+void _load_lazy_cels(Aseprite ase)
+{
+	if (ase.source == NULL)
+		return;
+
+	for (int j = 0; j < ase.layer_count; j++)
+	{
+		for (int i = 0; i < ase.layer_cel_count; i++)
+			_load_lazy_cel(ase, j, i);
+	}
+}
+void _recolor_atlas(Aseprite ase, _AseAtlas atlas, Image indices, const Color *lut)
+{
+	Image image = _expand_indices(indices, lut);
+
+	_AseResidentTexture *resident = ase.residency != NULL ? &((_AseResidentTexture *)ase.residency)[atlas] : NULL;
+
+	// An atlas kept as indices only takes the new colors, they are expanded again on every upload.
+
+	if (resident != NULL && resident->lut != NULL)
+	{
+		memcpy(resident->lut, lut, 256 * sizeof(Color));
+
+		if (resident->texture.id != 0)
+			UpdateTexture(resident->texture, image.data);
+	}
+	else
+		_update_texture_area(ase, atlas, (Rectangle){ 0, 0, image.width, image.height }, (const Color *)image.data);
+
+	UnloadImage(image);
+}
+void _build_palette_lut(Color *lut, const Color *palette, int color_count, int transparent_index)
+{
+	// Indices past the end of the palette draw nothing, like the transparent one.
+
+	for (int i = 0; i < 256; i++)
+		lut[i] = (palette != NULL && i < color_count) ? palette[i] : BLANK;
+
+	lut[transparent_index & 255] = BLANK;
+}
+Image _expand_indices(Image indices, const Color *lut)
+{
+	size_t pixel_count = (size_t)indices.width * indices.height;
+
+	Image image = {
+		.width = indices.width,
+		.height = indices.height,
+		.mipmaps = 1,
+		.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+		.data = malloc(pixel_count * sizeof(Color) + 1)
+	};
+
+	const unsigned char *source = (const unsigned char *)indices.data;
+	Color *pixels = (Color *)image.data;
+
+	for (size_t p = 0; p < pixel_count; p++)
+		pixels[p] = lut[source[p]];
+
+	return image;
+}
+Image _gen_index_image(int width, int height, int transparent_index)
+{
+	Image image = {
+		.width = width,
+		.height = height,
+		.mipmaps = 1,
+		.format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE,
+		.data = malloc((size_t)width * height + 1)
+	};
+
+	memset(image.data, transparent_index, (size_t)width * height);
+
+	return image;
+}
+
+// Texture residency functions
+
+void SetAsepriteTextureBudget(long long bytes)
+{
+	_texture_budget = bytes;
+
+	_make_room(0);
+}
+long long GetAsepriteTextureMemory(void)
+{
+	return _texture_memory;
+}
+void _manage_textures(Aseprite *ase, Image frames_image, Image cels_image, int owns_pixels)
+{
+	_AseResidentTexture *residency = (_AseResidentTexture *)calloc(2, sizeof(_AseResidentTexture));
+
+	Image images[2] = { frames_image, cels_image };
+	Image indices[2] = { ase->frames_indices, ase->cels_indices };
+	Texture2D textures[2] = { ase->frames_texture, ase->cels_texture };
+
+	for (int k = 0; k < 2; k++)
+	{
+		_AseResidentTexture *resident = &residency[k];
+
+		// Nothing was uploaded for this atlas, there is nothing to evict or upload again.
+
+		if (textures[k].id == 0)
+		{
+			if (owns_pixels)
+				UnloadImage(images[k]);
+
+			continue;
+		}
+
+		resident->texture = textures[k];
+
+		// Indexed atlases only keep the indices the Aseprite has anyway and a color for each.
+
+		if (_index_texture(resident, images[k], indices[k]))
+		{
+			if (owns_pixels)
+				UnloadImage(images[k]);
+		}
+		else
+			resident->image = owns_pixels ? images[k] : ImageCopy(images[k]);
+
+		_texture_memory += _resident_size(resident);
+
+		_link_newest(resident);
+	}
+
+	ase->residency = residency;
+
+	_make_room(0);
+}
+void _unmanage_textures(Aseprite ase)
+{
+	_AseResidentTexture *residency = (_AseResidentTexture *)ase.residency;
+
+	for (int k = 0; k < 2; k++)
+	{
+		_AseResidentTexture *resident = &residency[k];
+
+		if (resident->texture.id != 0)
+			_evict_texture(resident);
+
+		// The indices belong to the Aseprite, which unloads them itself.
+
+		if (resident->lut != NULL)
+			free(resident->lut);
+		else
+			UnloadImage(resident->image);
+	}
+
+	free(residency);
+}
+Texture2D _use_texture(Aseprite ase, _AseAtlas atlas)
+{
+	if (ase.residency == NULL)
+		return atlas == _ASE_CELS_ATLAS ? ase.cels_texture : ase.frames_texture;
+
+	_AseResidentTexture *resident = &((_AseResidentTexture *)ase.residency)[atlas];
+
+	if (resident->image.data == NULL)
+		return resident->texture;
+
+	if (resident->texture.id == 0)
+	{
+		// Evicted, the CPU copy goes back up once there is room for it.
+
+		_make_room(_resident_size(resident));
+
+		if (resident->lut != NULL)
+		{
+			Image image = _expand_indices(resident->image, resident->lut);
+
+			resident->texture = LoadTextureFromImage(image);
+
+			UnloadImage(image);
+		}
+		else
+			resident->texture = LoadTextureFromImage(resident->image);
 
-#define P_ANIMATION_CHECK(anim) if (anim == NULL) return; \
-								if (!anim->ready || anim->ase == NULL) return; \
-								if (!_aseprite_flags_check(anim->ase->flags, ASEPRITE_LOAD_TAGS)) return;
+		if (resident->texture.id == 0)
+			return resident->texture;
 
-#define ANIMATION_CHECK(anim) 	if (!anim.ready || anim.ase == NULL) return; \
-								if (!_aseprite_flags_check(anim.ase->flags, ASEPRITE_LOAD_TAGS)) return;
+		_texture_memory += _resident_size(resident);
+	}
+	else
+		_unlink_texture(resident);
 
-// Memory management functions
+	_link_newest(resident);
 
-Aseprite _load_aseprite(ase_t *cute_ase, AseLoadFlags flags)
+	return resident->texture;
+}
+void _update_texture_area(Aseprite ase, _AseAtlas atlas, Rectangle area, const Color *pixels)
 {
-	if (cute_ase == NULL || flags == 0)
-		return (Aseprite){0};
-	
-	Aseprite ase = {0};
+	if (area.width <= 0 || area.height <= 0)
+		return;
 
-	ase.flags = flags;
+	if (ase.residency == NULL)
+	{
+		UpdateTextureRec(atlas == _ASE_CELS_ATLAS ? ase.cels_texture : ase.frames_texture, area, pixels);
+		return;
+	}
 
-	ase.width = cute_ase->w;
-	ase.height = cute_ase->h;
+	_AseResidentTexture *resident = &((_AseResidentTexture *)ase.residency)[atlas];
 
-	if (flags & ASEPRITE_LOAD_FRAMES)
-		_load_aseprite_frames(cute_ase, &ase);
+	// The CPU copy always follows, an evicted texture picks the change up when it is uploaded again.
+	// Writes other than recoloring may not match the indices, so those atlases keep colors from now on.
 
-	if (flags & ASEPRITE_LOAD_LAYERS)
-		_load_aseprite_layers(cute_ase, &ase);
+	_unindex_texture(resident);
 
-	if (flags & ASEPRITE_LOAD_TAGS)
-		_load_aseprite_tags(cute_ase, &ase);
+	for (int y = 0; y < (int)area.height; y++)
+	{
+		Color *row = (Color *)resident->image.data + ((int)area.y + y) * resident->image.width + (int)area.x;
 
-	if (flags & ASEPRITE_LOAD_PALETTE)
-		_load_aseprite_palette(cute_ase, &ase);
+		memcpy(row, pixels + y * (int)area.width, (size_t)area.width * sizeof(Color));
+	}
 
-	return ase;
+	if (resident->texture.id != 0)
+		UpdateTextureRec(resident->texture, area, pixels);
 }
-
-void _load_aseprite_frames(ase_t *cute_ase, Aseprite *ase)
+int _index_texture(_AseResidentTexture *resident, Image image, Image indices)
 {
-	ase->frame_count = cute_ase->frame_count;
-	ase->frames = (AseFrame *)malloc(sizeof(AseFrame) * cute_ase->frame_count);
+	if (indices.data == NULL || indices.width != image.width || indices.height != image.height)
+		return 0;
 
-	Image image = GenImageColor(cute_ase->w * cute_ase->frame_count, cute_ase->h, BLANK);
+	Color *lut = (Color *)calloc(256, sizeof(Color));
+	unsigned char known[256] = {0};
 
-	for (int i = 0; i < cute_ase->frame_count; i++)
-	{
-		Rectangle frame_source =
-		{
-			.x = cute_ase->w * i,
-			.y = 0,
-			.width = cute_ase->w,
-			.height = cute_ase->h
-		};
+	size_t pixel_count = (size_t)image.width * image.height;
 
-		ase->frames[i].id = i;
+	const unsigned char *source = (const unsigned char *)indices.data;
+	const Color *pixels = (const Color *)image.data;
 
-		ase->frames[i].source = frame_source;
-		ase->frames[i].duration_milliseconds = (cute_ase->frames)[i].duration_milliseconds;
+	// Every pixel of an index must have the same color, otherwise the indices can't stand in for the atlas.
 
-		Image frame_image =
-		{
-			.width = cute_ase->w,
-			.height = cute_ase->h,
-			.mipmaps = 1,
-			.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-			.data = (cute_ase->frames)[i].pixels
-		};
+	for (size_t p = 0; p < pixel_count; p++)
+	{
+		unsigned char index = source[p];
 
-		Rectangle source = 
+		if (!known[index])
 		{
-			.x = 0,
-			.y = 0,
-			.width = cute_ase->w,
-			.height = cute_ase->h
-		};
+			lut[index] = pixels[p];
+			known[index] = 1;
+		}
+		else if (memcmp(&lut[index], &pixels[p], sizeof(Color)) != 0)
+		{
+			free(lut);
 
-		ImageDraw(&image, frame_image, source, ase->frames[i].source, WHITE);
+			return 0;
+		}
 	}
 
-	ase->frames_texture = LoadTextureFromImage(image);
+	resident->image = indices;
+	resident->lut = lut;
 
-	UnloadImage(image);
+	return 1;
 }
-void _load_aseprite_layers(ase_t *cute_ase, Aseprite *ase)
+void _unindex_texture(_AseResidentTexture *resident)
 {
-	ase->layer_count = cute_ase->layer_count;
-	ase->layers = (AseLayer *)malloc(cute_ase->layer_count * sizeof(AseLayer));
+	if (resident->lut == NULL)
+		return;
 
-	ase->layer_cel_count = cute_ase->frame_count;
+	resident->image = _expand_indices(resident->image, resident->lut);
 
-	for (int j = 0; j < cute_ase->layer_count; j++)
-	{
-		AseLayer *layer = &ase->layers[j];
-		
-		*layer = (AseLayer){
-			.id = j,
-			.name = strdup(cute_ase->layers[j].name),
+	free(resident->lut);
+	resident->lut = NULL;
+}
+void _make_room(long long size)
+{
+	while (_texture_budget > 0 && _oldest_texture != NULL && _texture_memory + size > _texture_budget)
+		_evict_texture(_oldest_texture);
+}
+void _evict_texture(_AseResidentTexture *resident)
+{
+	// Draws still waiting in the batch may be using it.
 
-			.opacity = cute_ase->layers[j].opacity,
+	rlDrawRenderBatchActive();
 
-			.cels = calloc(cute_ase->frame_count, sizeof(AseCel))
-		};
-	}
+	UnloadTexture(resident->texture);
 
-	for (int i = 0; i < ase->frame_count; i++)
-	{
-		ase_frame_t *cute_frame = &cute_ase->frames[i];
+	_texture_memory -= _resident_size(resident);
 
-		for (int k = 0; k < cute_frame->cel_count; k++)
-		{
-			ase_cel_t cute_cel = cute_frame->cels[k];
+	resident->texture.id = 0;
 
-			int j = cute_cel.layer - cute_ase->layers;
+	_unlink_texture(resident);
+}
+void _link_newest(_AseResidentTexture *resident)
+{
+	resident->newer = NULL;
+	resident->older = _newest_texture;
 
-			AseCel cel;
+	if (_newest_texture != NULL)
+		_newest_texture->newer = resident;
+	else
+		_oldest_texture = resident;
 
-			cel.active = 1;
+	_newest_texture = resident;
+}
+void _unlink_texture(_AseResidentTexture *resident)
+{
+	if (resident->newer != NULL)
+		resident->newer->older = resident->older;
+	else
+		_newest_texture = resident->older;
 
-			cel.opacity = cute_cel.opacity;
+	if (resident->older != NULL)
+		resident->older->newer = resident->newer;
+	else
+		_oldest_texture = resident->newer;
 
-			Image image = {
-				.width = cute_cel.w,
-				.height = cute_cel.h,
-				.mipmaps = 1,
-				.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
-				.data = cute_cel.pixels
-			};
+	resident->newer = NULL;
+	resident->older = NULL;
+}
+long long _resident_size(_AseResidentTexture *resident)
+{
+	// Indexed atlases are uploaded expanded to colors.
 
-			cel.texture = LoadTextureFromImage(image);
+	int format = resident->lut != NULL ? PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 : resident->image.format;
 
-			float x_offset = cute_cel.x;
-			float y_offset = cute_cel.y;
+	return GetPixelDataSize(resident->image.width, resident->image.height, format);
+}
 
-			Rectangle visible_area =
-			{
-				0, 0, cute_cel.w, cute_cel.h
-			};
+void _pack_rects(_AsePackRect *rects, int count, int *width, int *height)
+{
+	// Shelf packing, tallest first, into a width picked so the atlas comes out about square. A pixel of
+	// padding keeps filtered draws from bleeding into the neighbours.
 
-			if (x_offset < 0)
-			{
-				x_offset = 0;
+	const int padding = 1;
 
-				visible_area.x = -cute_cel.x;
-				visible_area.width += cute_cel.x;
-			}
+	double area = 0;
+	int max_width = 0;
 
-			if (y_offset < 0)
-			{
-				y_offset = 0;
+	for (int i = 0; i < count; i++)
+	{
+		area += (double)(rects[i].width + padding) * (rects[i].height + padding);
 
-				visible_area.y = -cute_cel.y;
-				visible_area.height += cute_cel.y;
-			}
+		if (rects[i].width > max_width)
+			max_width = rects[i].width;
+	}
 
-			if (x_offset + visible_area.width > cute_ase->w)
-			{
-				visible_area.width = cute_ase->w - x_offset;
-			}
+	int atlas_width = (int)ceil(sqrt(area));
 
-			if (y_offset + visible_area.height > cute_ase->h)
-			{
-				visible_area.height = cute_ase->h - y_offset;
-			}
+	if (atlas_width < max_width)
+		atlas_width = max_width;
 
-			cel.x_offset = x_offset;
-			cel.y_offset = y_offset;
+	qsort(rects, count, sizeof(_AsePackRect), _compare_pack_rects);
 
-			cel.visible_area = visible_area;
+	int x = 0;
+	int y = 0;
+	int shelf_height = 0;
+	int used_width = 0;
 
-			ase->layers[j].cels[i] = cel;
+	for (int i = 0; i < count; i++)
+	{
+		if (x > 0 && x + rects[i].width > atlas_width)
+		{
+			x = 0;
+			y += shelf_height + padding;
+			shelf_height = 0;
 		}
+
+		rects[i].x = x;
+		rects[i].y = y;
+
+		x += rects[i].width + padding;
+
+		if (rects[i].height > shelf_height)
+			shelf_height = rects[i].height;
+
+		if (rects[i].x + rects[i].width > used_width)
+			used_width = rects[i].x + rects[i].width;
 	}
+
+	*width = used_width;
+	*height = y + shelf_height;
 }
-void _load_aseprite_tags(ase_t *cute_ase, Aseprite *ase)
+int _compare_pack_rects(const void *a, const void *b)
 {
-	ase->tag_count = cute_ase->tag_count;
-	ase->tags = (AseTag *)malloc(sizeof(AseTag) * cute_ase->tag_count);
+	const _AsePackRect *rect_a = (const _AsePackRect *)a;
+	const _AsePackRect *rect_b = (const _AsePackRect *)b;
 
-	for (int i = 0; i < cute_ase->tag_count; i++)
+	if (rect_a->height != rect_b->height)
+		return rect_b->height - rect_a->height;
+
+	return rect_a->id - rect_b->id;
+}
+Rectangle _alpha_bounds(const Color *pixels, int width, int height)
+{
+	int left = width;
+	int right = -1;
+	int top = -1;
+	int bottom = -1;
+
+	for (int y = 0; y < height; y++)
 	{
-		ase_tag_t tag = (cute_ase->tags)[i];
+		const Color *row = pixels + (size_t)y * width;
 
-		ase->tags[i].id = i;
-		ase->tags[i].name = strdup(tag.name);
+		int x0 = 0;
 
-		ase->tags[i].color =
-		(Color){
-			.r = tag.r,
-			.g = tag.g,
-			.b = tag.b,
-			.a = 255
-		};
+		while (x0 < width && row[x0].a == 0)
+			x0++;
+
+		if (x0 == width)
+			continue;
 
-		ase->tags[i].anim_direction = tag.loop_animation_direction & 1;
-		ase->tags[i].ping_pong = (tag.loop_animation_direction & 2) >> 1;
+		int x1 = width - 1;
 
-		ase->tags[i].from_frame = tag.from_frame;
-		ase->tags[i].to_frame = tag.to_frame;
+		while (row[x1].a == 0)
+			x1--;
 
-		ase->tags[i].repeat = tag.repeat;
-		ase->tags[i].loop = !tag.repeat;
+		if (x0 < left)
+			left = x0;
+
+		if (x1 > right)
+			right = x1;
+
+		if (top < 0)
+			top = y;
+
+		bottom = y;
 	}
+
+	if (top < 0)
+		return (Rectangle){0};
+
+	return (Rectangle){ left, top, right - left + 1, bottom - top + 1 };
 }
-void _load_aseprite_palette(ase_t *cute_ase, Aseprite *ase)
+Rectangle _index_bounds(const unsigned char *indices, int width, int height, int transparent_index)
 {
-	ase->color_count = cute_ase->palette.entry_count;
-	ase->palette = (Color *)malloc(ase->color_count * sizeof(Color));
+	int left = width;
+	int right = -1;
+	int top = -1;
+	int bottom = -1;
 
-	for (int u = 0; u < ase->color_count; u++)
+	for (int y = 0; y < height; y++)
 	{
-		Color *color = &ase->palette[u];
-		ase_color_t cute = cute_ase->palette.entries[u].color;
+		const unsigned char *row = indices + (size_t)y * width;
 
-		color->r = cute.r;
-		color->g = cute.g;
-		color->b = cute.b;
-		color->a = cute.a;
-	}
-}
+		int x0 = 0;
 
-Aseprite LoadAsepriteFromFile(const char *filename, AseLoadFlags flags)
-{
-	if (!FileExists(filename))
-		return (Aseprite){0};
+		while (x0 < width && row[x0] == transparent_index)
+			x0++;
 
-	ase_t *cute_ase = cute_aseprite_load_from_file(filename, NULL);
+		if (x0 == width)
+			continue;
 
-	Aseprite ase = _load_aseprite(cute_ase, flags);
+		int x1 = width - 1;
 
-	cute_aseprite_free(cute_ase);
+		while (row[x1] == transparent_index)
+			x1--;
 
-	return ase;
-}
-Aseprite LoadAsepriteFromMemory(const void *data, int size, AseLoadFlags flags)
-{
-	ase_t *cute_ase = cute_aseprite_load_from_memory(data, size, NULL);
+		if (x0 < left)
+			left = x0;
 
-	Aseprite ase = _load_aseprite(cute_ase, flags);
+		if (x1 > right)
+			right = x1;
 
-	cute_aseprite_free(cute_ase);
+		if (top < 0)
+			top = y;
 
-	return ase;
-}
-void UnloadAseprite(Aseprite ase)
-{
-	if (ase.flags & ASEPRITE_LOAD_FRAMES)
-	{
-		UnloadTexture(ase.frames_texture);
+		bottom = y;
 	}
 
-	if (ase.flags & ASEPRITE_LOAD_LAYERS)
-	{
-		for (int j = 0; j < ase.layer_count; j++)
-		{
-			AseLayer layer = ase.layers[j];
+	if (top < 0)
+		return (Rectangle){0};
 
-			free((void *)layer.name);
+	return (Rectangle){ left, top, right - left + 1, bottom - top + 1 };
+}
+unsigned long long _hash_bytes(const void *data, size_t size)
+{
+	// Multiply and xorshift a word at a time. Only used to find candidates, matches are compared in full.
 
-			for (int i = 0; i < ase.layer_cel_count; i++)
-			{
-				AseCel cel = layer.cels[i];
+	const unsigned char *bytes = (const unsigned char *)data;
+	unsigned long long hash = 14695981039346656037ULL ^ size;
 
-				UnloadTexture(cel.texture);
-			}
+	size_t i = 0;
 
-			free((void *)layer.cels);
-		}
+	for (; i + 8 <= size; i += 8)
+	{
+		unsigned long long word;
 
-		free((void *)ase.layers);
+		memcpy(&word, bytes + i, 8);
+
+		hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 32;
 	}
 
-	if (ase.flags & ASEPRITE_LOAD_TAGS)
-	{
-		for (int i = 0; i < ase.tag_count; i++)
-		{
-			AseTag tag = ase.tags[i];
+	for (; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
 
-			free((void *)tag.name);
-		}
+	return hash;
+}
 
-		free((void *)ase.tags);
-	}
+void _write_u32(unsigned char **cursor, unsigned int value)
+{
+	unsigned char *bytes = *cursor;
 
-	if (ase.flags & ASEPRITE_LOAD_PALETTE)
-	{
-		free((void *)ase.palette);
-	}
+	bytes[0] = value & 0xFF;
+	bytes[1] = (value >> 8) & 0xFF;
+	bytes[2] = (value >> 16) & 0xFF;
+	bytes[3] = (value >> 24) & 0xFF;
 
-	free((void *)ase.frames);
+	*cursor += 4;
 }
+void _write_f32(unsigned char **cursor, float value)
+{
+	unsigned int bits;
 
-int IsAsepriteReady(Aseprite ase)
+	memcpy(&bits, &value, sizeof(bits));
+
+	_write_u32(cursor, bits);
+}
+int _rect_in_image(Rectangle rect, unsigned int width, unsigned int height)
 {
-	return ase.flags;
+	return rect.x >= 0 && rect.y >= 0 && rect.width >= 0 && rect.height >= 0 && rect.x + rect.width <= (float)width && rect.y + rect.height <= (float)height;
+}
+unsigned int _read_u32(const unsigned char **cursor)
+{
+	const unsigned char *bytes = *cursor;
+
+	*cursor += 4;
+
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
 }
+float _read_f32(const unsigned char **cursor)
+{
+	unsigned int bits = _read_u32(cursor);
+	float value;
+
+	memcpy(&value, &bits, sizeof(value));
 
+	return value;
+}
 int _aseprite_flags_check(AseLoadFlags flags, AseLoadFlags check)
 {
 	return (flags & check) == check;
 }
 
+ase_load_flags_t _cute_load_flags(AseLoadFlags flags)
+{
+	// Frames need composited pixels and layers need cel pixels, tags and palette need neither.
+
+	int cute_flags = 0;
+
+	if (flags & ASEPRITE_LOAD_FRAMES)
+		cute_flags |= ASE_LOAD_FLAGS_FRAME_PIXELS;
+
+	if ((flags & ASEPRITE_LOAD_INDEXED) && (flags & ASEPRITE_LOAD_FRAMES))
+		cute_flags |= ASE_LOAD_FLAGS_FRAME_INDICES;
+
+	if (flags & ASEPRITE_LOAD_LAYERS)
+		cute_flags |= ASE_LOAD_FLAGS_CEL_PIXELS;
+
+	if ((flags & ASEPRITE_LOAD_LAZY_CELS) && (flags & ASEPRITE_LOAD_LAYERS))
+		cute_flags |= ASE_LOAD_FLAGS_LAZY_CELS;
+
+	if (flags & ASEPRITE_LOAD_PARALLEL)
+		cute_flags |= ASE_LOAD_FLAGS_PARALLEL;
+
+	// Unless the parsed file is kept around for lazy cels, it is freed right after the upload, so it
+	// can all live in one arena.
+
+	if (!(cute_flags & ASE_LOAD_FLAGS_LAZY_CELS))
+		cute_flags |= ASE_LOAD_FLAGS_ARENA;
+
+	return (ase_load_flags_t)cute_flags;
+}
+
 // Motionless draw functions
 
 void DrawFrame(Aseprite ase, int frame, float x, float y, Color tint)
@@ -328,10 +2782,11 @@ void DrawFrame(Aseprite ase, int frame, float x, float y, Color tint)
 	if (frame < 0 || frame >= ase.frame_count)
 		return;
 
-	Texture2D texture = ase.frames_texture;
+	Texture2D texture = _use_texture(ase, _ASE_FRAMES_ATLAS);
 	Rectangle source = ase.frames[frame].source;
+	Vector2 position = {ase.frames[frame].x_offset + x, ase.frames[frame].y_offset + y};
 
-	DrawTextureRec(texture, source, (Vector2){x, y}, tint);
+	DrawTextureRec(texture, source, position, tint);
 }
 void DrawFrameV(Aseprite ase, int frame, Vector2 position, Color tint)
 {
@@ -341,9 +2796,12 @@ void DrawFrameV(Aseprite ase, int frame, Vector2 position, Color tint)
 	if (frame < 0 || frame >= ase.frame_count)
 		return;
 
-	Texture2D texture = ase.frames_texture;
+	Texture2D texture = _use_texture(ase, _ASE_FRAMES_ATLAS);
 	Rectangle source = ase.frames[frame].source;
 
+	position.x += ase.frames[frame].x_offset;
+	position.y += ase.frames[frame].y_offset;
+
 	DrawTextureRec(texture, source, position, tint);
 }
 void DrawFrameEx(Aseprite ase, int frame, Vector2 position, float scale, float rotation, Color tint)
@@ -354,14 +2812,28 @@ void DrawFrameEx(Aseprite ase, int frame, Vector2 position, float scale, float r
 	if (frame < 0 || frame >= ase.frame_count)
 		return;
 
-	Texture2D texture = ase.frames_texture;
-	Rectangle source = ase.frames[frame].source;
+	AseFrame ase_frame = ase.frames[frame];
+
+	Texture2D texture = _use_texture(ase, _ASE_FRAMES_ATLAS);
+	Rectangle source = ase_frame.source;
+
+	// Frames are trimmed, so the offset has to be scaled and mirrored like the pixels themselves.
+
+	Vector2 origin;
 
 	if (scale < 0)
 	{
+		origin.x = (ase.width - ase_frame.x_offset - source.width) * scale;
+		origin.y = (ase.height - ase_frame.y_offset - source.height) * scale;
+
 		source.width *= -1;
 		source.height *= -1;
 	}
+	else
+	{
+		origin.x = -ase_frame.x_offset * scale;
+		origin.y = -ase_frame.y_offset * scale;
+	}
 
 	Rectangle dest = 
 	{
@@ -371,7 +2843,7 @@ void DrawFrameEx(Aseprite ase, int frame, Vector2 position, float scale, float r
 		.height = source.height * scale
 	};
 
-	DrawTexturePro(texture, source, dest, (Vector2){0,0}, rotation, tint);
+	DrawTexturePro(texture, source, dest, origin, rotation, tint);
 }
 void DrawFrameScale(Aseprite ase, int frame, Vector2 position, Vector2 origin, float x_scale, float y_scale, float rotation, Color tint)
 {
@@ -381,22 +2853,35 @@ void DrawFrameScale(Aseprite ase, int frame, Vector2 position, Vector2 origin, f
 	if (frame < 0 || frame >= ase.frame_count)
 		return;
 
-	Texture2D texture = ase.frames_texture;
-	Rectangle source = ase.frames[frame].source;
+	AseFrame ase_frame = ase.frames[frame];
+
+	Texture2D texture = _use_texture(ase, _ASE_FRAMES_ATLAS);
+	Rectangle source = ase_frame.source;
 
 	origin.x *= x_scale;
-	origin.y *= y_scale;
 
 	if (x_scale < 0)
 	{
+		origin.x = -origin.x + (ase.width - ase_frame.x_offset - source.width) * x_scale;
+
 		source.width *= -1;
-		origin.x *= -1;
 	}
-	
+	else
+	{
+		origin.x += -ase_frame.x_offset * x_scale;
+	}
+
+	origin.y *= y_scale;
+
 	if (y_scale < 0)
 	{
+		origin.y = -origin.y + (ase.height - ase_frame.y_offset - source.height) * y_scale;
+
 		source.height *= -1;
-		origin.y *= -1;
+	}
+	else
+	{
+		origin.y += -ase_frame.y_offset * y_scale;
 	}
 
 	Rectangle dest = 
@@ -420,6 +2905,8 @@ void DrawCel(Aseprite ase, int layer, int frame, float x, float y, Color tint)
 
 	if (frame < 0 || frame >= ase.layer_cel_count)
 		return;
+
+	_load_lazy_cel(ase, layer, frame);
 	
 	AseLayer ase_layer = ase.layers[layer];
 	AseCel cel = ase_layer.cels[frame];
@@ -427,7 +2914,7 @@ void DrawCel(Aseprite ase, int layer, int frame, float x, float y, Color tint)
 	if (!cel.active)
 		return;
 
-	Texture2D texture = cel.texture;
+	Texture2D texture = _use_texture(ase, _ASE_CELS_ATLAS);
 	Rectangle source = cel.visible_area;
 	Vector2 position = {cel.x_offset + x, cel.y_offset + y};
 	tint.a *= ase_layer.opacity * cel.opacity;
@@ -444,6 +2931,8 @@ void DrawCelV(Aseprite ase, int layer, int frame, Vector2 position, Color tint)
 
 	if (frame < 0 || frame >= ase.layer_cel_count)
 		return;
+
+	_load_lazy_cel(ase, layer, frame);
 	
 	AseLayer ase_layer = ase.layers[layer];
 	AseCel cel = ase_layer.cels[frame];
@@ -451,7 +2940,7 @@ void DrawCelV(Aseprite ase, int layer, int frame, Vector2 position, Color tint)
 	if (!cel.active)
 		return;
 
-	Texture2D texture = cel.texture;
+	Texture2D texture = _use_texture(ase, _ASE_CELS_ATLAS);
 	Rectangle source = cel.visible_area;
 
 	position.x += cel.x_offset;
@@ -471,6 +2960,8 @@ void DrawCelEx(Aseprite ase, int layer, int frame, Vector2 position, float scale
 
 	if (frame < 0 || frame >= ase.layer_cel_count)
 		return;
+
+	_load_lazy_cel(ase, layer, frame);
 	
 	AseLayer ase_layer = ase.layers[layer];
 	AseCel cel = ase_layer.cels[frame];
@@ -478,7 +2969,7 @@ void DrawCelEx(Aseprite ase, int layer, int frame, Vector2 position, float scale
 	if (!cel.active)
 		return;
 
-	Texture2D texture = cel.texture;
+	Texture2D texture = _use_texture(ase, _ASE_CELS_ATLAS);
 	Rectangle source = cel.visible_area;
 
 	Vector2 origin;
@@ -519,6 +3010,8 @@ void DrawCelScale(Aseprite ase, int layer, int frame, Vector2 position, Vector2
 
 	if (frame < 0 || frame >= ase.layer_cel_count)
 		return;
+
+	_load_lazy_cel(ase, layer, frame);
 	
 	AseLayer ase_layer = ase.layers[layer];
 	AseCel cel = ase_layer.cels[frame];
@@ -526,7 +3019,7 @@ void DrawCelScale(Aseprite ase, int layer, int frame, Vector2 position, Vector2
 	if (!cel.active)
 		return;
 
-	Texture2D texture = cel.texture;
+	Texture2D texture = _use_texture(ase, _ASE_CELS_ATLAS);
 	Rectangle source = cel.visible_area;
 
 	origin.x *= x_scale;
@@ -783,10 +3276,44 @@ void _advance_animation_tag_mode(AseAnimation *anim)
 	}
 }
 
+void _clamp_animation(AseAnimation *anim)
+{
+	// A hot reload may leave fewer frames than the animation was made for, and ping-ponging a
+	// tag shrunk to one frame steps off either end of it.
+
+	int last_frame = anim->ase->frame_count > 0 ? anim->ase->frame_count - 1 : 0;
+
+	if (anim->current_frame > last_frame)
+		anim->current_frame = last_frame;
+
+	if (anim->current_frame < 0)
+		anim->current_frame = 0;
+
+	if (anim->current_tag.to_frame > last_frame)
+		anim->current_tag.to_frame = last_frame;
+
+	if (anim->current_tag.from_frame > anim->current_tag.to_frame)
+		anim->current_tag.from_frame = anim->current_tag.to_frame;
+
+	// Its tag may be gone too, then the animation plays every frame instead of stepping into
+	// tags that no longer exist.
+
+	if (anim->current_tag.id >= anim->ase->tag_count)
+	{
+		anim->tag_mode = 0;
+		anim->current_tag.id = -1;
+	}
+}
+
 void AdvanceAnimation(AseAnimation *anim)
 {
 	P_ANIMATION_CHECK(anim)
 
+	_clamp_animation(anim);
+
+	if (anim->ase->frame_count == 0)
+		return;
+
 	float delta_time = GetFrameTime();
 
 	if (delta_time == 0 || anim->speed == 0 || !anim->running)
@@ -836,18 +3363,24 @@ void AdvanceAnimation(AseAnimation *anim)
 void DrawAnimation(AseAnimation anim, float x, float y, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawFrame(*anim.ase, anim.current_frame, x, y, tint);
 }
 void DrawAnimationV(AseAnimation anim, Vector2 position, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawFrameV(*anim.ase, anim.current_frame, position, tint);
 }
 void DrawAnimationEx(AseAnimation anim, Vector2 position, float rotation, float scale, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawFrameEx(*anim.ase, anim.current_frame, position, rotation, scale, tint);
 }
@@ -855,30 +3388,40 @@ void DrawAnimationScale(AseAnimation anim, Vector2 position, Vector2 origin, flo
 {
 	ANIMATION_CHECK(anim)
 
+	_clamp_animation(&anim);
+
 	DrawFrameScale(*anim.ase, anim.current_frame, position, origin, x_scale, y_scale, rotation, tint);
 }
 
 void DrawAnimLayer(AseAnimation anim, int layer, float x, float y, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawCel(*anim.ase, layer, anim.current_frame, x, y, tint);
 }
 void DrawAnimLayerV(AseAnimation anim, int layer, Vector2 position, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawCelV(*anim.ase, layer, anim.current_frame, position, tint);
 }
 void DrawAnimLayerEx(AseAnimation anim, int layer, Vector2 position, float scale, float rotation, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawCelEx(*anim.ase, layer, anim.current_frame, position, scale, rotation, tint);
 }
 void DrawAnimLayerScale(AseAnimation anim, int layer, Vector2 position, Vector2 origin, float x_scale, float y_scale, float rotation, Color tint)
 {
 	ANIMATION_CHECK(anim)
+
+	_clamp_animation(&anim);
 	
 	DrawCelScale(*anim.ase, layer, anim.current_frame, position, origin, x_scale, y_scale, rotation, tint);
 }
\ No newline at end of file
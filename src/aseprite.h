@@ -2,6 +2,10 @@
 
 #include <raylib.h>
 
+// Precompiled files written by ExportAsepriteBinary(), the magic reads "ASEB" on disk.
+#define ASEPRITE_BINARY_MAGIC 0x42455341
+#define ASEPRITE_BINARY_VERSION 1
+
 typedef enum AseAnimDirection
 {
 	ASEPRITE_ANIM_FORWARDS,
@@ -14,9 +18,24 @@ typedef enum AseLoadFlags
 	ASEPRITE_LOAD_LAYERS = 2,
 	ASEPRITE_LOAD_TAGS = 4,
 	ASEPRITE_LOAD_PALETTE = 8,
-	ASEPRITE_LOAD_ALL = 15
+	ASEPRITE_LOAD_ALL = 15,
+
+	ASEPRITE_LOAD_LAZY_CELS = 16,	// Decode cels and create their textures the first time they are drawn
+	ASEPRITE_LOAD_PARALLEL = 32,	// Inflate the cels and composite the frames of a file on worker threads
+	ASEPRITE_LOAD_INDEXED = 64	// Keep the palette indices of indexed files for SetAsepritePalette(), dropped for other files and for files with translucent layers, cels or colors
 } AseLoadFlags;
 
+// Why a load failed, or what was off in a file that still loaded (ASEPRITE_ERROR_INFLATE_FAILED and later).
+typedef enum AseError
+{
+	ASEPRITE_ERROR_NONE = 0,
+	ASEPRITE_ERROR_FILE_NOT_FOUND,
+	ASEPRITE_ERROR_TRUNCATED,
+	ASEPRITE_ERROR_INVALID_FILE,
+	ASEPRITE_ERROR_INFLATE_FAILED,	// A cel failed to decompress and is drawn fully transparent
+	ASEPRITE_ERROR_UNSUPPORTED_BLEND_MODE	// A layer is blended as normal instead of its own blend mode
+} AseError;
+
 // An Aseprite file tag data structure.
 typedef struct AseTag
 {
@@ -38,8 +57,12 @@ typedef struct AseTag
 typedef struct AseCel
 {
 	int active;
+	int loaded;
 
-	Texture2D texture;
+	Texture2D texture;	// The atlas holding every cel of the file, visible_area is where this one lies
+
+	int is_linked;
+	int linked_frame;	// Frame of the cel whose pixels this one shares when linked
 
 	float x_offset;
 	float y_offset;
@@ -65,9 +88,12 @@ typedef struct AseFrame
 {
 	int id;
 
-	Rectangle source;
+	Rectangle source;	// Trimmed to the visible pixels, may be shared by identical frames
 	int duration_milliseconds;
 
+	float x_offset;	// Where source lies within the canvas
+	float y_offset;
+
 } AseFrame;
 
 // Centralized data structure that contains relevant Aseprite file data.
@@ -82,6 +108,7 @@ typedef struct Aseprite
 	AseFrame *frames;
 	int frame_count;
 
+	Texture2D cels_texture;	// Every visible cel packed together
 	AseLayer *layers;
 	int layer_count;
 	int layer_cel_count;
@@ -91,8 +118,77 @@ typedef struct Aseprite
 
 	Color *palette;
 	int color_count;
+
+	Image frames_indices;	// Topmost palette index of every pixel of frames_texture (ASEPRITE_LOAD_INDEXED)
+	Image cels_indices;	// Palette index of every pixel of cels_texture, one byte each (ASEPRITE_LOAD_INDEXED)
+	int transparent_index;	// Index drawn fully transparent whatever color the palette gives it
+
+	void *source;	// Parsed file kept around to decode cels on demand (ASEPRITE_LOAD_LAZY_CELS)
+	void *residency;	// Set under a texture budget, frames_texture and cels_texture may then be evicted and are only safe to use through the draw functions
+
+	AseError error;	// Set by the load functions, also when the load failed
 } Aseprite;
 
+// CPU side counterparts of AseCel and AseLayer, their visible_area lies in AseDecoded.cels_image.
+typedef struct AseDecodedCel
+{
+	int active;
+
+	int is_linked;
+	int linked_frame;	// Frame of the cel whose pixels this one shares when linked
+
+	float x_offset;
+	float y_offset;
+
+	Rectangle visible_area;
+
+	float opacity;
+} AseDecodedCel;
+
+typedef struct AseDecodedLayer
+{
+	int id;
+	const char *name;
+
+	float opacity;
+
+	AseDecodedCel *cels;
+
+} AseDecodedLayer;
+
+// A decoded Aseprite file that has not been uploaded to the GPU yet. Needs no GL context, so it can be
+// built on any thread or without a window, then turned into an Aseprite by UploadAseprite().
+typedef struct AseDecoded
+{
+	AseLoadFlags flags;
+
+	int width;
+	int height;
+
+	Image frames_image;	// Every distinct frame packed together, frames[i].source is where each one lies
+	AseFrame *frames;
+	int frame_count;
+
+	Image cels_image;	// Every visible cel packed together, blank for lazy cels until they are drawn
+	AseDecodedLayer *layers;
+	int layer_count;
+	int layer_cel_count;
+
+	AseTag *tags;
+	int tag_count;
+
+	Color *palette;
+	int color_count;
+
+	Image frames_indices;	// Topmost palette index of every pixel of frames_image (ASEPRITE_LOAD_INDEXED)
+	Image cels_indices;	// Palette index of every pixel of cels_image, one byte each (ASEPRITE_LOAD_INDEXED)
+	int transparent_index;	// Index drawn fully transparent whatever color the palette gives it
+
+	void *source;	// Parsed file kept around to decode cels on demand (ASEPRITE_LOAD_LAZY_CELS)
+
+	AseError error;	// Set by the decode functions, also when decoding failed
+} AseDecoded;
+
 // Data structure for playing animations.
 typedef struct AseAnimation
 {
@@ -111,12 +207,49 @@ typedef struct AseAnimation
 	AseTag current_tag;
 } AseAnimation;
 
+// A file watched for changes by WatchAseprite().
+typedef struct AseWatch AseWatch;
+
+// Custom zlib decompressor for compressed cels. Must fill all pixels_size bytes and return non-zero on success.
+typedef int (*AseInflateCallback)(const void *data, int data_size, void *pixels, int pixels_size);
+
+// Stream reader for LoadAsepriteFromStream. Fills up to size bytes of buffer and returns how many were read, 0 at the end of the stream.
+typedef int (*AseReadCallback)(void *buffer, int size, void *user_data);
+
 // Load functions.
 
 Aseprite LoadAsepriteFromFile(const char *filename, AseLoadFlags flags);
 Aseprite LoadAsepriteFromMemory(const void *data, int size, AseLoadFlags flags);
+Aseprite LoadAsepriteFromStream(AseReadCallback read, void *user_data, AseLoadFlags flags);	// Parses chunk by chunk, the file is never fully in memory
+int LoadAsepriteBatch(const char **filenames, int count, AseLoadFlags flags, Aseprite *aseprites);	// Decodes on worker threads, uploads textures on this thread. Returns the number loaded
 void UnloadAseprite(Aseprite ase);
 
+AseDecoded DecodeAsepriteFromFile(const char *filename, AseLoadFlags flags);	// CPU only, safe without a window
+AseDecoded DecodeAsepriteFromMemory(const void *data, int size, AseLoadFlags flags);
+AseDecoded DecodeAsepriteFromStream(AseReadCallback read, void *user_data, AseLoadFlags flags);
+Aseprite UploadAseprite(AseDecoded decoded);	// Creates the textures and takes over the rest of decoded, which must not be unloaded afterwards
+void UnloadAsepriteDecoded(AseDecoded decoded);	// Only for decoded data that never gets uploaded
+
+int ExportAsepriteBinary(AseDecoded decoded, const char *filename);	// Writes atlases and metadata ready to upload as is. Returns non-zero on success, decoded is left untouched
+Aseprite LoadAsepriteBinary(const char *filename);
+Aseprite LoadAsepriteBinaryFromMemory(const void *data, int size);	// Textures are uploaded straight from data, which may be a mapped file and is not kept
+AseDecoded DecodeAsepriteBinaryFromMemory(const void *data, int size);
+
+AseWatch *WatchAseprite(Aseprite *ase, const char *filename);	// Uses inotify on Linux, polls the modification time elsewhere. ase must outlive the watch
+int ReloadAsepriteIfChanged(AseWatch *watch);	// Updates ase in place, only re-uploading the frames and cels that changed since the previous reload. Returns non-zero after a reload
+void UnwatchAseprite(AseWatch *watch);
+
+Aseprite *AcquireAseprite(const char *filename, AseLoadFlags flags);	// Shared by every caller with the same filename and flags, loaded by the first while the others wait. The first acquire of a file uploads its textures, so it must run on the thread owning the GL context. NULL when the load fails
+void ReleaseAseprite(Aseprite *ase);	// Unloads it once the last reference is released, on the thread owning the GL context
+
+Aseprite LoadAsepriteVariant(Aseprite ase, const Color *palette, int color_count);	// Copy of ase with its own textures, colored from palette instead. Needs ASEPRITE_LOAD_INDEXED
+void SetAsepritePalette(Aseprite ase, const Color *palette, int color_count);	// Recolors the textures of ase in place, cheap enough to cycle colors every frame. Translucent colors cover the pixels below them. Needs ASEPRITE_LOAD_INDEXED
+
+void SetAsepriteInflateCallback(AseInflateCallback callback);	// Set NULL to use the built-in inflater
+void SetAsepriteCacheDirectory(const char *directory);	// LoadAsepriteFromFile keeps decoded files here, keyed by content and flags. Set NULL to disable, not thread safe
+void SetAsepriteTextureBudget(long long bytes);	// Past this much VRAM the least recently drawn atlases are unloaded and uploaded again when drawn. 0 disables. Aseprites uploaded before it is set stay unmanaged. Each managed atlas keeps a CPU copy in RGBA, only its indices with ASEPRITE_LOAD_INDEXED until a lazy cel or a reload writes to it
+long long GetAsepriteTextureMemory(void);	// VRAM used by the atlases under the budget
+
 int IsAsepriteReady(Aseprite ase);
 
 // Motionless draw functions.
@@ -0,0 +1,77 @@
+/*
+	Checks that a custom inflater produces exactly the pixels of the built-in one. zlib stands in
+	for the custom backend.
+
+		cc -I../src inflate_backends.c -o inflate_backends -lz -lpthread
+		./inflate_backends player.ase slime.ase
+
+	Exits with a non-zero status when any cel or frame differs.
+*/
+
+#define CUTE_ASEPRITE_IMPLEMENTATION
+#include "cute_aseprite.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+static int zlib_inflate(const void* in, int in_bytes, void* out, int out_bytes, void* udata)
+{
+	CUTE_ASEPRITE_UNUSED(udata);
+	uLongf out_size = (uLongf)out_bytes;
+	return uncompress((Bytef*)out, &out_size, (const Bytef*)in, (uLong)in_bytes) == Z_OK && out_size == (uLongf)out_bytes;
+}
+
+static int bpp(ase_t* ase)
+{
+	return ase->mode == ASE_MODE_RGBA ? 4 : ase->mode == ASE_MODE_GRAYSCALE ? 2 : 1;
+}
+
+static int compare(const char* path)
+{
+	cute_aseprite_set_inflate(NULL, NULL);
+	ase_t* builtin = cute_aseprite_load_from_file(path, NULL);
+	cute_aseprite_set_inflate(zlib_inflate, NULL);
+	ase_t* custom = cute_aseprite_load_from_file(path, NULL);
+	cute_aseprite_set_inflate(NULL, NULL);
+
+	if (!builtin || !custom) {
+		printf("%s: failed to load\n", path);
+		if (builtin) cute_aseprite_free(builtin);
+		if (custom) cute_aseprite_free(custom);
+		return 0;
+	}
+
+	int differences = 0;
+	size_t frame_size = sizeof(ase_color_t) * (size_t)builtin->w * (size_t)builtin->h;
+	for (int i = 0; i < builtin->frame_count; ++i) {
+		ase_frame_t* a = builtin->frames + i;
+		ase_frame_t* b = custom->frames + i;
+		if (memcmp(a->pixels, b->pixels, frame_size)) differences++;
+		for (int j = 0; j < a->cel_count; ++j) {
+			ase_cel_t* cel_a = a->cels + j;
+			ase_cel_t* cel_b = b->cels + j;
+			if (cel_a->is_linked || !cel_a->pixels) continue;
+			if (!cel_b->pixels || memcmp(cel_a->pixels, cel_b->pixels, (size_t)cel_a->w * cel_a->h * bpp(builtin))) differences++;
+		}
+	}
+
+	printf("%s: %s\n", path, differences ? "DIFFERENT" : "identical");
+	cute_aseprite_free(builtin);
+	cute_aseprite_free(custom);
+	return !differences;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) {
+		printf("usage: %s file.ase...\n", argv[0]);
+		return 1;
+	}
+
+	int passed = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (!compare(argv[i])) passed = 0;
+	}
+	return passed ? 0 : 1;
+}